@@ -0,0 +1,177 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "AODCompression.h"
+
+#include <arrow/buffer.h>
+#include <arrow/memory_pool.h>
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace o2::framework::run2 {
+
+namespace {
+constexpr char frameMagic[4] = {'A', 'O', 'D', 'Z'};
+
+std::unique_ptr<arrow::util::Codec> makeCodec(arrow::Compression::type codec) {
+  std::unique_ptr<arrow::util::Codec> result;
+  if (arrow::util::Codec::Create(codec, &result).ok() == false) {
+    throw std::runtime_error(std::string("Codec not available: ") +
+                             codecName(codec));
+  }
+  return result;
+}
+} // namespace
+
+arrow::Compression::type parseCodec(std::string const &name) {
+  static std::map<std::string, arrow::Compression::type> const codecs{
+      {"none", arrow::Compression::UNCOMPRESSED},
+      {"lz4", arrow::Compression::LZ4},
+      {"zstd", arrow::Compression::ZSTD},
+      {"snappy", arrow::Compression::SNAPPY},
+      {"gzip", arrow::Compression::GZIP},
+      {"brotli", arrow::Compression::BROTLI}};
+  auto codec = codecs.find(name);
+  if (codec == codecs.end()) {
+    throw std::runtime_error("Unknown codec " + name);
+  }
+  return codec->second;
+}
+
+char const *codecName(arrow::Compression::type codec) {
+  switch (codec) {
+  case arrow::Compression::UNCOMPRESSED:
+    return "none";
+  case arrow::Compression::LZ4:
+    return "lz4";
+  case arrow::Compression::ZSTD:
+    return "zstd";
+  case arrow::Compression::SNAPPY:
+    return "snappy";
+  case arrow::Compression::GZIP:
+    return "gzip";
+  case arrow::Compression::BROTLI:
+    return "brotli";
+  default:
+    return "unknown";
+  }
+}
+
+CompressionPolicy::CompressionPolicy(std::string const &spec) {
+  std::stringstream items(spec);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    auto equal = item.find('=');
+    if (equal == std::string::npos) {
+      mDefault = parseCodec(item);
+      continue;
+    }
+    auto table = item.substr(0, equal);
+    if (table.find('.') != std::string::npos) {
+      throw std::runtime_error("Per column compression (" + table +
+                               ") is not supported, the stream of each "
+                               "table is compressed as a whole");
+    }
+    mPerTable[table] = parseCodec(item.substr(equal + 1));
+  }
+}
+
+arrow::Compression::type
+CompressionPolicy::codecFor(std::string const &description) const {
+  auto codec = mPerTable.find(description);
+  return codec == mPerTable.end() ? mDefault : codec->second;
+}
+
+std::shared_ptr<arrow::Buffer> compressStream(arrow::Buffer const &stream,
+                                              arrow::Compression::type codec) {
+  auto compressor = makeCodec(codec);
+  int64_t maxSize = compressor->MaxCompressedLen(stream.size(), stream.data());
+  std::shared_ptr<arrow::ResizableBuffer> frame;
+  if (arrow::AllocateResizableBuffer(arrow::default_memory_pool(),
+                                     compressedFrameHeaderSize + maxSize + 8,
+                                     &frame)
+          .ok() == false) {
+    throw std::runtime_error("Unable to allocate compression buffer");
+  }
+  auto data = frame->mutable_data();
+  int64_t compressedSize = 0;
+  if (compressor
+          ->Compress(stream.size(), stream.data(), maxSize,
+                     data + compressedFrameHeaderSize, &compressedSize)
+          .ok() == false) {
+    throw std::runtime_error(std::string("Unable to compress with ") +
+                             codecName(codec));
+  }
+  int32_t codecId = codec;
+  int64_t uncompressedSize = stream.size();
+  memcpy(data, frameMagic, sizeof(frameMagic));
+  memcpy(data + 4, &codecId, sizeof(codecId));
+  memcpy(data + 8, &compressedSize, sizeof(compressedSize));
+  memcpy(data + 16, &uncompressedSize, sizeof(uncompressedSize));
+  CompressedFrameHeader header{codec, compressedSize, uncompressedSize};
+  int64_t payloadEnd = compressedFrameHeaderSize + compressedSize;
+  memset(data + payloadEnd, 0, header.frameSize() - payloadEnd);
+  if (frame->Resize(header.frameSize()).ok() == false) {
+    throw std::runtime_error("Unable to resize compression buffer");
+  }
+  return frame;
+}
+
+bool isCompressedFrame(uint8_t const *data, int64_t size) {
+  return size >= compressedFrameHeaderSize &&
+         memcmp(data, frameMagic, sizeof(frameMagic)) == 0;
+}
+
+int64_t CompressedFrameHeader::frameSize() const {
+  return (compressedFrameHeaderSize + compressedSize + 7) / 8 * 8;
+}
+
+CompressedFrameHeader readFrameHeader(uint8_t const *data, int64_t size) {
+  if (isCompressedFrame(data, size) == false) {
+    throw std::runtime_error("Not a compressed AOD frame");
+  }
+  int32_t codecId;
+  CompressedFrameHeader header;
+  memcpy(&codecId, data + 4, sizeof(codecId));
+  memcpy(&header.compressedSize, data + 8, sizeof(header.compressedSize));
+  memcpy(&header.uncompressedSize, data + 16, sizeof(header.uncompressedSize));
+  header.codec = static_cast<arrow::Compression::type>(codecId);
+  if (std::string(codecName(header.codec)) == "unknown" ||
+      header.codec == arrow::Compression::UNCOMPRESSED) {
+    throw std::runtime_error("Unsupported codec " + std::to_string(codecId) +
+                             " in compressed AOD frame");
+  }
+  if (header.compressedSize < 0 || header.uncompressedSize < 0) {
+    throw std::runtime_error("Corrupted compressed AOD frame");
+  }
+  return header;
+}
+
+std::shared_ptr<arrow::Buffer>
+decompressFrame(CompressedFrameHeader const &header, uint8_t const *payload) {
+  auto decompressor = makeCodec(header.codec);
+  std::shared_ptr<arrow::Buffer> result;
+  if (arrow::AllocateBuffer(arrow::default_memory_pool(),
+                            header.uncompressedSize, &result)
+          .ok() == false) {
+    throw std::runtime_error("Unable to allocate decompression buffer");
+  }
+  if (decompressor
+          ->Decompress(header.compressedSize, payload, header.uncompressedSize,
+                       result->mutable_data())
+          .ok() == false) {
+    throw std::runtime_error(std::string("Unable to decompress with ") +
+                             codecName(header.codec));
+  }
+  return result;
+}
+
+} // namespace o2::framework::run2
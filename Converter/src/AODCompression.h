@@ -0,0 +1,80 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_AODCompression_H_INCLUDED
+#define o2_framework_run2_AODCompression_H_INCLUDED
+
+#include <arrow/util/compression.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace arrow {
+class Buffer;
+}
+
+namespace o2::framework::run2 {
+
+/// Parses a codec name (none, lz4, zstd, snappy, gzip, brotli).
+arrow::Compression::type parseCodec(std::string const &name);
+char const *codecName(arrow::Compression::type codec);
+
+/// Which codec is used for the stream of each table, e.g.
+/// "TRACKPARCOV=zstd,TRACKPAR=none,lz4" compresses TRACKPARCOV with ZSTD,
+/// leaves TRACKPAR alone and uses LZ4 for all the other tables. The policy
+/// is per table only: the IPC format of the Arrow version in use has no
+/// buffer compression, so a stream is compressed as a whole and columns
+/// cannot get codecs of their own. Column entries (TABLE.column=...) are
+/// rejected.
+class CompressionPolicy {
+public:
+  CompressionPolicy() = default;
+  explicit CompressionPolicy(std::string const &spec);
+
+  arrow::Compression::type codecFor(std::string const &description) const;
+
+private:
+  std::map<std::string, arrow::Compression::type> mPerTable;
+  arrow::Compression::type mDefault = arrow::Compression::UNCOMPRESSED;
+};
+
+/// A compressed table stream is written as a frame: the "AODZ" magic, the
+/// codec as int32_t, the compressed and the uncompressed sizes as int64_t,
+/// then the compressed Arrow stream, padded to 8 bytes. Since Arrow streams
+/// start with a (small) metadata length, frames and plain streams can be
+/// told apart from their first four bytes. Such frames are not Arrow
+/// streams: readers unwrap them first, see scripts/aodStreams.py for Python.
+constexpr int64_t compressedFrameHeaderSize = 24;
+
+/// Compresses the Arrow stream held by @a stream into a frame.
+std::shared_ptr<arrow::Buffer> compressStream(arrow::Buffer const &stream,
+                                              arrow::Compression::type codec);
+
+/// Whether the @a size bytes at @a data start with a compressed frame.
+bool isCompressedFrame(uint8_t const *data, int64_t size);
+
+/// Sizes and codec of the frame whose header is at @a data.
+struct CompressedFrameHeader {
+  arrow::Compression::type codec;
+  int64_t compressedSize;
+  int64_t uncompressedSize;
+  /// Size of the whole frame, including header and padding.
+  int64_t frameSize() const;
+};
+CompressedFrameHeader readFrameHeader(uint8_t const *data, int64_t size);
+
+/// Decompresses the payload of the frame described by @a header.
+std::shared_ptr<arrow::Buffer>
+decompressFrame(CompressedFrameHeader const &header, uint8_t const *payload);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_AODCompression_H_INCLUDED
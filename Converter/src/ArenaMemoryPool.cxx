@@ -0,0 +1,203 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "ArenaMemoryPool.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+namespace o2::framework::run2 {
+
+namespace {
+/// Alignment of each allocation, as required by Arrow.
+constexpr int64_t alignment = 64;
+constexpr int64_t hugePageSize = 2 << 20;
+
+/// Arrow hands out this address for empty buffers, there is no need to go
+/// through the arenas for them.
+alignas(alignment) uint8_t zeroSizeArea[1];
+
+int64_t roundUp(int64_t size, int64_t to) { return (size + to - 1) / to * to; }
+} // namespace
+
+ArenaMemoryPool::ArenaMemoryPool(int64_t arenaSize)
+    : mArenaSize{roundUp(arenaSize, hugePageSize)} {}
+
+ArenaMemoryPool::~ArenaMemoryPool() {
+  for (auto &arena : mArenas) {
+    free(arena.first);
+  }
+}
+
+uint8_t *ArenaMemoryPool::bump(int64_t size) {
+  size = roundUp(size, alignment);
+  if (mCurrent != nullptr) {
+    auto &arena = mArenas[mCurrent];
+    if (arena.used + size <= arena.size) {
+      mLast = mCurrent + arena.used;
+      arena.used += size;
+      ++arena.live;
+      return mLast;
+    }
+    // The current arena is full: it goes away with its last allocation.
+    if (arena.live == 0) {
+      release(mArenas.find(mCurrent));
+    }
+    mCurrent = nullptr;
+    mLast = nullptr;
+  }
+  int64_t const arenaSize = std::max(mArenaSize, roundUp(size, hugePageSize));
+  void *base = nullptr;
+  if (posix_memalign(&base, hugePageSize, arenaSize) != 0) {
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(base, arenaSize, MADV_HUGEPAGE);
+#endif
+  mCurrent = static_cast<uint8_t *>(base);
+  mLast = mCurrent;
+  mArenas[mCurrent] = Arena{arenaSize, size, 1};
+  mStats.arenaBytes += arenaSize;
+  mStats.peakArenaBytes = std::max(mStats.peakArenaBytes, mStats.arenaBytes);
+  return mCurrent;
+}
+
+std::map<uint8_t *, ArenaMemoryPool::Arena>::iterator
+ArenaMemoryPool::arenaOf(uint8_t *buffer) {
+  auto it = mArenas.upper_bound(buffer);
+  return --it;
+}
+
+void ArenaMemoryPool::release(std::map<uint8_t *, Arena>::iterator arena) {
+  mStats.arenaBytes -= arena->second.size;
+  free(arena->first);
+  mArenas.erase(arena);
+}
+
+arrow::Status ArenaMemoryPool::Allocate(int64_t size, uint8_t **out) {
+  if (size == 0) {
+    *out = zeroSizeArea;
+    return arrow::Status::OK();
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  *out = bump(size);
+  if (*out == nullptr) {
+    return arrow::Status::OutOfMemory("Unable to allocate an arena for " +
+                                      std::to_string(size) + " bytes");
+  }
+  ++mStats.allocations;
+  mStats.bytes += size;
+  mStats.peakBytes = std::max(mStats.peakBytes, mStats.bytes);
+  return arrow::Status::OK();
+}
+
+arrow::Status ArenaMemoryPool::Reallocate(int64_t oldSize, int64_t newSize,
+                                          uint8_t **ptr) {
+  if (*ptr == zeroSizeArea) {
+    return Allocate(newSize, ptr);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mStats.reallocations;
+    // Shrinking, or growing the last allocation while it still fits in its
+    // arena, leaves the buffer where it is.
+    bool inPlace = roundUp(newSize, alignment) <= roundUp(oldSize, alignment);
+    if (inPlace == false && *ptr == mLast) {
+      auto &arena = mArenas[mCurrent];
+      int64_t const end = (mLast - mCurrent) + roundUp(newSize, alignment);
+      if (end <= arena.size) {
+        arena.used = end;
+        inPlace = true;
+      }
+    }
+    if (inPlace) {
+      ++mStats.inPlaceReallocations;
+      mStats.bytes += newSize - oldSize;
+      mStats.peakBytes = std::max(mStats.peakBytes, mStats.bytes);
+      return arrow::Status::OK();
+    }
+  }
+  uint8_t *moved = nullptr;
+  auto status = Allocate(newSize, &moved);
+  if (status.ok() == false) {
+    return status;
+  }
+  memcpy(moved, *ptr, std::min(oldSize, newSize));
+  Free(*ptr, oldSize);
+  *ptr = moved;
+  std::lock_guard<std::mutex> lock(mMutex);
+  // Allocate and Free counted a separate allocation and free.
+  --mStats.allocations;
+  --mStats.frees;
+  return arrow::Status::OK();
+}
+
+void ArenaMemoryPool::Free(uint8_t *buffer, int64_t size) {
+  if (buffer == zeroSizeArea) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  ++mStats.frees;
+  mStats.bytes -= size;
+  auto arena = arenaOf(buffer);
+  if (buffer == mLast) {
+    // Freeing the last allocation gives its space back right away.
+    arena->second.used = mLast - mCurrent;
+    mLast = nullptr;
+  }
+  if (--arena->second.live != 0) {
+    return;
+  }
+  if (arena->first == mCurrent) {
+    arena->second.used = 0;
+    mLast = nullptr;
+  } else {
+    release(arena);
+  }
+}
+
+int64_t ArenaMemoryPool::bytes_allocated() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats.bytes;
+}
+
+int64_t ArenaMemoryPool::max_memory() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats.peakBytes;
+}
+
+ArenaMemoryPool::Stats ArenaMemoryPool::stats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
+
+void printMemoryStats(
+    std::ostream &out,
+    std::vector<std::pair<std::string, ArenaMemoryPool::Stats>> const &pools) {
+  constexpr double MB = 1 << 20;
+  out << std::setw(14) << "pool" << std::setw(10) << "allocs" << std::setw(10)
+      << "reallocs" << std::setw(10) << "in place" << std::setw(12)
+      << "peak (MB)" << std::setw(12) << "arenas (MB)" << "\n";
+  for (auto &[name, stats] : pools) {
+    out << std::setw(14) << name << std::setw(10) << stats.allocations
+        << std::setw(10) << stats.reallocations << std::setw(10)
+        << stats.inPlaceReallocations << std::setw(12)
+        << stats.peakBytes / MB << std::setw(12)
+        << stats.peakArenaBytes / MB << "\n";
+  }
+  out << std::flush;
+}
+
+} // namespace o2::framework::run2
@@ -0,0 +1,95 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_ArenaMemoryPool_H_INCLUDED
+#define o2_framework_run2_ArenaMemoryPool_H_INCLUDED
+
+#include <arrow/memory_pool.h>
+#include <arrow/status.h>
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace o2::framework::run2 {
+
+/// An arrow::MemoryPool carving allocations out of large arenas, aligned to
+/// (and advised as) huge pages. Allocations are simply bumped one after the
+/// other, so that the typical growth pattern of a builder, reallocating its
+/// most recent buffer, happens in place without any copy. An arena is given
+/// back to the system once all the allocations in it are freed, hence the
+/// pool must outlive all the buffers it allocates. Thread safe.
+class ArenaMemoryPool : public arrow::MemoryPool {
+public:
+  /// Counters since the creation of the pool.
+  struct Stats {
+    int64_t allocations = 0;
+    int64_t reallocations = 0;
+    /// Reallocations which did not need to move the buffer.
+    int64_t inPlaceReallocations = 0;
+    int64_t frees = 0;
+    int64_t bytes = 0;
+    int64_t peakBytes = 0;
+    /// Memory reserved for the arenas.
+    int64_t arenaBytes = 0;
+    int64_t peakArenaBytes = 0;
+  };
+
+  explicit ArenaMemoryPool(int64_t arenaSize = int64_t(64) << 20);
+  ~ArenaMemoryPool() override;
+  ArenaMemoryPool(ArenaMemoryPool const &) = delete;
+  ArenaMemoryPool &operator=(ArenaMemoryPool const &) = delete;
+
+  arrow::Status Allocate(int64_t size, uint8_t **out) override;
+  arrow::Status Reallocate(int64_t oldSize, int64_t newSize,
+                           uint8_t **ptr) override;
+  void Free(uint8_t *buffer, int64_t size) override;
+  int64_t bytes_allocated() const override;
+  int64_t max_memory() const override;
+
+  Stats stats() const;
+
+private:
+  struct Arena {
+    int64_t size = 0;
+    /// Bytes bumped so far.
+    int64_t used = 0;
+    /// Allocations not freed yet.
+    int64_t live = 0;
+  };
+
+  /// Allocates @a size bytes, with the mutex held.
+  uint8_t *bump(int64_t size);
+  /// The arena containing @a buffer.
+  std::map<uint8_t *, Arena>::iterator arenaOf(uint8_t *buffer);
+  void release(std::map<uint8_t *, Arena>::iterator arena);
+
+  int64_t mArenaSize;
+  /// Arenas, by base address.
+  std::map<uint8_t *, Arena> mArenas;
+  /// Base of the arena allocations are currently bumped from.
+  uint8_t *mCurrent = nullptr;
+  /// Most recent allocation of the current arena, which can grow in place.
+  uint8_t *mLast = nullptr;
+  Stats mStats;
+  mutable std::mutex mMutex;
+};
+
+/// Prints the statistics of each of the named @a pools, one per line.
+void printMemoryStats(
+    std::ostream &out,
+    std::vector<std::pair<std::string, ArenaMemoryPool::Stats>> const &pools);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_ArenaMemoryPool_H_INCLUDED
@@ -0,0 +1,182 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "ColumnPrecision.h"
+
+#include <TClass.h>
+#include <TFile.h>
+#include <TList.h>
+#include <TStreamerElement.h>
+#include <TStreamerInfo.h>
+
+#include <arrow/array.h>
+#include <arrow/buffer.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+#include <arrow/util/key_value_metadata.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace o2::framework::run2 {
+
+namespace {
+/// AOD float columns which are a copy of a Double32_t ESD member. Derived
+/// columns, such as the chi2 per cluster (fITSchi2Ncl, fTPCchi2Ncl), are not
+/// listed: rounding them again would add an error on top of the one of the
+/// members they are computed from.
+std::vector<ColumnPrecision> const esdFloatColumns{
+    {"TRACKEXTRA", "fTRDchi2", "AliESDtrack", "fTRDchi2"},
+    {"TRACKEXTRA", "fTOFchi2", "AliESDtrack", "fTOFchi2"},
+    {"TRACKEXTRA", "fTPCsignal", "AliESDtrack", "fTPCsignal"},
+    {"TRACKEXTRA", "fTRDsignal", "AliESDtrack", "fTRDsignal"},
+    {"CALO", "fAmplitude", "AliESDCaloCells", "fAmplitude"},
+    {"CALO", "fTime", "AliESDCaloCells", "fTime"},
+    {"MUON", "fInverseBendingMomentum", "AliESDMuonTrack",
+     "fInverseBendingMomentum"},
+    {"MUON", "fThetaX", "AliESDMuonTrack", "fThetaX"},
+    {"MUON", "fThetaY", "AliESDMuonTrack", "fThetaY"},
+    {"MUON", "fZ", "AliESDMuonTrack", "fZ"},
+    {"MUON", "fBendingCoor", "AliESDMuonTrack", "fBendingCoor"},
+    {"MUON", "fNonBendingCoor", "AliESDMuonTrack", "fNonBendingCoor"},
+    {"MUON", "fChi2", "AliESDMuonTrack", "fChi2"},
+    {"MUON", "fChi2MatchTrigger", "AliESDMuonTrack", "fChi2MatchTrigger"},
+};
+
+/// The most recent streamer info for @a className in @a infos.
+TStreamerInfo *latestStreamerInfo(TList *infos, char const *className) {
+  TStreamerInfo *latest = nullptr;
+  TIter next(infos);
+  while (auto object = next()) {
+    auto info = dynamic_cast<TStreamerInfo *>(object);
+    if (info && strcmp(info->GetName(), className) == 0 &&
+        (latest == nullptr ||
+         info->GetClassVersion() > latest->GetClassVersion())) {
+      latest = info;
+    }
+  }
+  if (latest == nullptr) {
+    if (auto cl = TClass::GetClass(className)) {
+      latest = static_cast<TStreamerInfo *>(cl->GetStreamerInfo());
+    }
+  }
+  return latest;
+}
+} // namespace
+
+float truncateMantissa(float value, int nbits) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t mantissa = ((1u << (nbits + 1)) - 1) & (bits >> (23 - nbits - 1));
+  ++mantissa;
+  mantissa >>= 1;
+  if (mantissa & (1u << nbits)) {
+    mantissa = (1u << nbits) - 1;
+  }
+  bits = (bits & 0xff800000u) | (mantissa << (23 - nbits));
+  memcpy(&value, &bits, sizeof(bits));
+  return value;
+}
+
+float ColumnPrecision::apply(float value) const {
+  if (factor != 0) {
+    double x = value < xmin ? xmin : (value > xmax ? xmax : value);
+    auto steps = static_cast<uint32_t>(0.5 + factor * (x - xmin));
+    return xmin + steps / factor;
+  }
+  if (mantissaBits != 0) {
+    return truncateMantissa(value, mantissaBits);
+  }
+  return value;
+}
+
+std::vector<ColumnPrecision> esdColumnPrecisions(TFile *file) {
+  std::unique_ptr<TList> infos(file ? file->GetStreamerInfoList() : nullptr);
+  std::vector<ColumnPrecision> result;
+  for (auto precision : esdFloatColumns) {
+    auto info = latestStreamerInfo(infos.get(), precision.esdClass.c_str());
+    if (info == nullptr) {
+      throw std::runtime_error("No streamer info for " + precision.esdClass);
+    }
+    auto element = static_cast<TStreamerElement *>(
+        info->GetElements()->FindObject(precision.esdMember.c_str()));
+    if (element == nullptr) {
+      throw std::runtime_error("No " + precision.esdMember + " in " +
+                               precision.esdClass);
+    }
+    if (TString(element->GetTypeName()).BeginsWith("Double32_t")) {
+      // See TStreamerElement::GetRange: a range gives a factor, while the
+      // number of mantissa bits alone ends up in xmin.
+      precision.factor = element->GetFactor();
+      if (precision.factor != 0) {
+        precision.xmin = element->GetXmin();
+        precision.xmax = element->GetXmax();
+      } else if (element->GetXmin() >= 2) {
+        precision.mantissaBits = static_cast<int>(element->GetXmin());
+      }
+    }
+    result.push_back(precision);
+  }
+  return result;
+}
+
+void printColumnPrecisions(std::ostream &out,
+                           std::vector<ColumnPrecision> const &precisions) {
+  for (auto &precision : precisions) {
+    out << precision.table << "." << precision.column << " <- "
+        << precision.esdClass << "::" << precision.esdMember << ": ";
+    if (precision.factor != 0) {
+      out << "[" << precision.xmin << ", " << precision.xmax << "] in steps of "
+          << 1. / precision.factor;
+    } else if (precision.mantissaBits != 0) {
+      out << precision.mantissaBits << " mantissa bits";
+    } else {
+      out << "full precision";
+    }
+    out << "\n";
+  }
+}
+
+void reducePrecision(arrow::Table const &table,
+                     std::vector<ColumnPrecision> const &precisions) {
+  std::unordered_map<std::string, std::string> meta;
+  table.schema()->metadata()->ToUnorderedMap(&meta);
+  for (auto &precision : precisions) {
+    if (precision.table != meta["description"] || precision.lossless()) {
+      continue;
+    }
+    auto ci = table.schema()->GetFieldIndex(precision.column);
+    if (ci < 0 || table.schema()->field(ci)->type()->id() !=
+                      arrow::Type::FLOAT) {
+      throw std::runtime_error("No float column " + precision.column +
+                               " in " + precision.table);
+    }
+    for (auto &chunk : table.column(ci)->data()->chunks()) {
+      auto data = chunk->data();
+      auto &values = data->buffers[1];
+      if (data->length == 0) {
+        continue;
+      }
+      if (values->is_mutable() == false) {
+        throw std::runtime_error("Cannot modify " + precision.column +
+                                 " in place");
+      }
+      auto floats =
+          reinterpret_cast<float *>(values->mutable_data()) + data->offset;
+      for (int64_t ri = 0; ri < data->length; ++ri) {
+        floats[ri] = precision.apply(floats[ri]);
+      }
+    }
+  }
+}
+
+} // namespace o2::framework::run2
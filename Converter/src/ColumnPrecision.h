@@ -0,0 +1,70 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_ColumnPrecision_H_INCLUDED
+#define o2_framework_run2_ColumnPrecision_H_INCLUDED
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TFile;
+
+namespace arrow {
+class Table;
+}
+
+namespace o2::framework::run2 {
+
+/// The precision an AOD float column actually has, given the Double32_t
+/// annotation of the ESD member it is filled from. Either:
+///
+/// - [0,0,nbits] with nbits < 15: the mantissa is truncated to nbits bits;
+/// - [xmin,xmax,nbits]: values are quantized on 2^nbits steps in the range;
+/// - otherwise the member is stored as a full float and nothing is lost.
+struct ColumnPrecision {
+  std::string table;
+  std::string column;
+  std::string esdClass;
+  std::string esdMember;
+
+  int mantissaBits = 0;
+  double xmin = 0;
+  double xmax = 0;
+  double factor = 0;
+
+  bool lossless() const { return mantissaBits == 0 && factor == 0; }
+  /// Reduces @a value to the precision of the ESD member, rounding exactly
+  /// as TBufferFile::WriteDouble32 does.
+  float apply(float value) const;
+};
+
+/// Mantissa truncation to @a nbits bits, rounding to nearest and saturating
+/// the mantissa rather than touching the exponent, as ROOT does for
+/// Double32_t members annotated with [0,0,nbits].
+float truncateMantissa(float value, int nbits);
+
+/// Derives the precision of the AOD float columns filled straight from a
+/// Double32_t ESD member from the streamer info stored in @a file (the most
+/// recent version of each class), falling back on the one of the compiled
+/// classes.
+std::vector<ColumnPrecision> esdColumnPrecisions(TFile *file);
+
+void printColumnPrecisions(std::ostream &out,
+                           std::vector<ColumnPrecision> const &precisions);
+
+/// Applies @a precisions to the float columns of @a table in place. The table
+/// must own its (freshly built) buffers.
+void reducePrecision(arrow::Table const &table,
+                     std::vector<ColumnPrecision> const &precisions);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_ColumnPrecision_H_INCLUDED
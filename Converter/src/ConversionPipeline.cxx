@@ -0,0 +1,229 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "ConversionPipeline.h"
+#include "TableSink.h"
+
+#include <TFile.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+
+namespace o2::framework::run2 {
+
+namespace {
+
+/// A queue between two pipeline stages. push() blocks while the queue is
+/// full, pop() while it is empty. Once closed, push() drops its argument and
+/// pop() returns nothing as soon as the queue is drained.
+template <typename T> class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : mCapacity{capacity} {}
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock,
+                    [this]() { return mClosed || mItems.size() < mCapacity; });
+    if (mClosed) {
+      return;
+    }
+    mItems.push_back(std::move(value));
+    mCondition.notify_all();
+  }
+
+  std::optional<T> pop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this]() { return mClosed || !mItems.empty(); });
+    if (mItems.empty()) {
+      return std::nullopt;
+    }
+    T value = std::move(mItems.front());
+    mItems.pop_front();
+    mCondition.notify_all();
+    return value;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClosed = true;
+    mCondition.notify_all();
+  }
+
+private:
+  size_t mCapacity;
+  std::deque<T> mItems;
+  bool mClosed = false;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+};
+
+/// An ESD file which is open and ready to be converted.
+struct OpenedFile {
+  std::unique_ptr<TFile> file;
+  TTree *tree = nullptr;
+};
+
+/// Keeps the tables of a file around, so that they can be written by the
+/// write stage while the next file is converted.
+class CollectingSink : public TableSink {
+public:
+  void write(std::shared_ptr<arrow::Table> const &table) override {
+    tables.push_back(table);
+  }
+  std::vector<std::shared_ptr<arrow::Table>> tables;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// Runs @a f and adds the time it took to @a seconds.
+template <typename F> auto timed(double &seconds, F &&f) {
+  auto start = Clock::now();
+  struct Accumulate {
+    double &seconds;
+    Clock::time_point start;
+    ~Accumulate() { seconds += secondsSince(start); }
+  } accumulate{seconds, start};
+  return f();
+}
+
+} // namespace
+
+void PipelineTimings::print(std::ostream &out) const {
+  auto printStage = [&out](char const *name, Stage const &stage) {
+    out << "  " << name << ": " << stage.busy << " s busy, " << stage.waiting
+        << " s waiting\n";
+  };
+  out << "Converted " << files << " files in " << total << " s\n";
+  printStage("open   ", open);
+  printStage("convert", convert);
+  printStage("write  ", write);
+}
+
+PipelineTimings convertFiles(std::vector<std::string> const &filenames,
+                             Run3AODConverter::Options const &options,
+                             TableSink &sink) {
+  ROOT::EnableThreadSafety();
+  auto const start = Clock::now();
+  bool const writeStage = options.batchEvents == 0;
+
+  PipelineTimings timings;
+  BoundedQueue<OpenedFile> opened(1);
+  BoundedQueue<std::vector<std::shared_ptr<arrow::Table>>> converted(1);
+  std::mutex errorMutex;
+  std::exception_ptr error;
+  auto fail = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+    opened.close();
+    converted.close();
+  };
+
+  std::thread opener([&]() {
+    try {
+      for (auto &filename : filenames) {
+        OpenedFile next = timed(timings.open.busy, [&]() {
+          OpenedFile result;
+          result.file.reset(TFile::Open(filename.c_str()));
+          if (!result.file || result.file->IsZombie()) {
+            throw std::runtime_error("Unable to open " + filename);
+          }
+          result.tree = (TTree *)result.file->Get("esdTree");
+          if (result.tree == nullptr) {
+            throw std::runtime_error("Unable to find esdTree in " + filename);
+          }
+          Run3AODConverter::prepare(result.tree, options);
+          return result;
+        });
+        timed(timings.open.waiting, [&]() { opened.push(std::move(next)); });
+      }
+    } catch (...) {
+      fail();
+    }
+    opened.close();
+  });
+
+  std::thread writer([&]() {
+    try {
+      while (true) {
+        auto tables = timed(timings.write.waiting,
+                            [&]() { return converted.pop(); });
+        if (!tables) {
+          break;
+        }
+        timed(timings.write.busy, [&]() {
+          for (auto &table : *tables) {
+            sink.write(table);
+          }
+          sink.flush();
+        });
+      }
+    } catch (...) {
+      fail();
+    }
+  });
+
+  // Collision ids run on from one file to the next.
+  Run3AODConverter::Options fileOptions = options;
+  try {
+    while (true) {
+      auto next =
+          timed(timings.convert.waiting, [&]() { return opened.pop(); });
+      if (!next) {
+        break;
+      }
+      if (writeStage == false) {
+        timed(timings.convert.busy, [&]() {
+          fileOptions.offsets =
+              Run3AODConverter::convert(next->tree, sink, fileOptions);
+        });
+        ++timings.files;
+        continue;
+      }
+      CollectingSink collected;
+      timed(timings.convert.busy, [&]() {
+        fileOptions.offsets =
+            Run3AODConverter::convert(next->tree, collected, fileOptions);
+      });
+      // The file is not needed anymore, close it before possibly blocking.
+      next.reset();
+      timed(timings.convert.waiting,
+            [&]() { converted.push(std::move(collected.tables)); });
+      ++timings.files;
+    }
+  } catch (...) {
+    fail();
+  }
+  converted.close();
+  opener.join();
+  writer.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  timings.total = secondsSince(start);
+  return timings;
+}
+
+} // namespace o2::framework::run2
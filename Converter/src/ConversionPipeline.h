@@ -0,0 +1,58 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_ConversionPipeline_H_INCLUDED
+#define o2_framework_run2_ConversionPipeline_H_INCLUDED
+
+#include "Run3AODConverter.h"
+#include "TableSink.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace o2::framework::run2 {
+
+/// Time spent by each stage of the pipeline, in seconds. Busy is the time
+/// spent doing actual work, waiting the time spent blocked on the queues
+/// connecting the stages.
+struct PipelineTimings {
+  struct Stage {
+    double busy = 0;
+    double waiting = 0;
+  };
+  Stage open;
+  Stage convert;
+  Stage write;
+  double total = 0;
+  size_t files = 0;
+
+  void print(std::ostream &out) const;
+};
+
+/// Converts a list of ESD files, one after the other, to the same @a sink.
+/// Three stages run concurrently: while file N is being converted, file N+1
+/// is opened and its first cluster prefetched (see
+/// Run3AODConverter::prepare()) and the tables of file N-1 are serialized to
+/// the sink. The stages are connected by queues holding a single file, which
+/// bounds the memory used. Collisions are numbered consecutively across all
+/// the files, starting from options.offsets, and the rows of the per
+/// collision tables are counted across all of them too.
+///
+/// In batch mode (Options::batchEvents) the tables are written out by the
+/// conversion stage itself, so that memory usage stays flat, and only the
+/// opening of the files is overlapped.
+PipelineTimings convertFiles(std::vector<std::string> const &filenames,
+                             Run3AODConverter::Options const &options,
+                             TableSink &sink);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_ConversionPipeline_H_INCLUDED
@@ -0,0 +1,445 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "Framework/Expressions.h"
+
+#include <arrow/record_batch.h>
+#include <arrow/table.h>
+#include <arrow/util/key_value_metadata.h>
+#include <gandiva/tree_expr_builder.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace o2::framework::expressions
+{
+
+namespace
+{
+/// A gandiva node together with its type.
+struct TypedNode {
+  gandiva::NodePtr node;
+  atype::type type;
+};
+
+std::mutex gFilterCacheMutex;
+std::unordered_map<std::string, std::shared_ptr<gandiva::Filter>> gFilterCache;
+FilterCacheStats gFilterCacheStats;
+
+DatumSpec flatten(Node const& node, Operations& ops)
+{
+  if (auto literal = std::get_if<LiteralNode>(&node.self)) {
+    return DatumSpec{std::in_place_type<LiteralNode::var_t>, literal->value};
+  }
+  if (auto binding = std::get_if<BindingNode>(&node.self)) {
+    return DatumSpec{std::in_place_type<std::string>, binding->name};
+  }
+  if (auto unary = std::get_if<UnaryOpNode>(&node.self)) {
+    auto arg = flatten(*node.left, ops);
+    ops.push_back(ColumnOperationSpec{unary->op, std::move(arg), DatumSpec{}});
+    return DatumSpec{std::in_place_type<size_t>, ops.size() - 1};
+  }
+  auto op = std::get<BinaryOpNode>(node.self).op;
+  auto left = flatten(*node.left, ops);
+  auto right = flatten(*node.right, ops);
+  ops.push_back(ColumnOperationSpec{op, std::move(left), std::move(right)});
+  return DatumSpec{std::in_place_type<size_t>, ops.size() - 1};
+}
+
+char const* gandivaFunction(BasicOp op)
+{
+  switch (op) {
+    case BasicOp::Addition:
+      return "add";
+    case BasicOp::Subtraction:
+      return "subtract";
+    case BasicOp::Division:
+      return "divide";
+    case BasicOp::Multiplication:
+      return "multiply";
+    case BasicOp::LessThan:
+      return "less_than";
+    case BasicOp::LessThanOrEqual:
+      return "less_than_or_equal_to";
+    case BasicOp::GreaterThan:
+      return "greater_than";
+    case BasicOp::GreaterThanOrEqual:
+      return "greater_than_or_equal_to";
+    case BasicOp::Equal:
+      return "equal";
+    case BasicOp::NotEqual:
+      return "not_equal";
+    case BasicOp::Exp:
+      return "exp";
+    case BasicOp::Log:
+      return "log";
+    case BasicOp::Log10:
+      return "log10";
+    default:
+      throw std::runtime_error("Not a gandiva function");
+  }
+}
+
+bool isUnary(BasicOp op)
+{
+  return op >= BasicOp::Abs;
+}
+
+bool isComparison(BasicOp op)
+{
+  return op == BasicOp::LessThan || op == BasicOp::LessThanOrEqual ||
+         op == BasicOp::GreaterThan || op == BasicOp::GreaterThanOrEqual ||
+         op == BasicOp::Equal || op == BasicOp::NotEqual;
+}
+
+std::shared_ptr<arrow::DataType> arrowType(atype::type type)
+{
+  switch (type) {
+    case atype::BOOL:
+      return arrow::boolean();
+    case atype::INT8:
+      return arrow::int8();
+    case atype::INT16:
+      return arrow::int16();
+    case atype::INT32:
+      return arrow::int32();
+    case atype::INT64:
+      return arrow::int64();
+    case atype::UINT8:
+      return arrow::uint8();
+    case atype::UINT16:
+      return arrow::uint16();
+    case atype::UINT32:
+      return arrow::uint32();
+    case atype::UINT64:
+      return arrow::uint64();
+    case atype::FLOAT:
+      return arrow::float32();
+    case atype::DOUBLE:
+      return arrow::float64();
+    default:
+      throw std::runtime_error("Unsupported type in filter expression");
+  }
+}
+
+/// Literal @a value converted to @a type, so that it can be compared or
+/// combined with a column of that type.
+gandiva::NodePtr makeLiteral(LiteralNode::var_t const& value, atype::type type)
+{
+  return std::visit(
+    [type](auto v) -> gandiva::NodePtr {
+      using gandiva::TreeExprBuilder;
+      switch (type) {
+        case atype::BOOL:
+          return TreeExprBuilder::MakeLiteral(static_cast<bool>(v));
+        case atype::INT8:
+          return TreeExprBuilder::MakeLiteral(static_cast<int8_t>(v));
+        case atype::INT16:
+          return TreeExprBuilder::MakeLiteral(static_cast<int16_t>(v));
+        case atype::INT32:
+          return TreeExprBuilder::MakeLiteral(static_cast<int32_t>(v));
+        case atype::INT64:
+          return TreeExprBuilder::MakeLiteral(static_cast<int64_t>(v));
+        case atype::UINT8:
+          return TreeExprBuilder::MakeLiteral(static_cast<uint8_t>(v));
+        case atype::UINT16:
+          return TreeExprBuilder::MakeLiteral(static_cast<uint16_t>(v));
+        case atype::UINT32:
+          return TreeExprBuilder::MakeLiteral(static_cast<uint32_t>(v));
+        case atype::UINT64:
+          return TreeExprBuilder::MakeLiteral(static_cast<uint64_t>(v));
+        case atype::FLOAT:
+          return TreeExprBuilder::MakeLiteral(static_cast<float>(v));
+        case atype::DOUBLE:
+          return TreeExprBuilder::MakeLiteral(static_cast<double>(v));
+        default:
+          throw std::runtime_error("Unsupported literal type in filter expression");
+      }
+    },
+    value);
+}
+
+atype::type literalType(LiteralNode::var_t const& value)
+{
+  return std::visit([](auto v) { return selectArrowType<decltype(v)>(); }, value);
+}
+
+/// Ordering used to promote mixed operands: integers, then floats, then
+/// doubles.
+int typeRank(atype::type type)
+{
+  return type == atype::DOUBLE ? 2 : type == atype::FLOAT ? 1 : 0;
+}
+
+TypedNode promote(TypedNode const& operand, atype::type type)
+{
+  if (operand.type == type) {
+    return operand;
+  }
+  char const* cast = type == atype::DOUBLE ? "castFLOAT8" : type == atype::FLOAT ? "castFLOAT4" : type == atype::INT64 ? "castBIGINT" : nullptr;
+  if (cast == nullptr) {
+    throw std::runtime_error("Unable to combine operands of different types in filter expression");
+  }
+  return TypedNode{gandiva::TreeExprBuilder::MakeFunction(cast, {operand.node}, arrowType(type)), type};
+}
+
+/// abs(x), as x < 0 ? 0 - x : x, keeping the type of x.
+TypedNode makeAbs(TypedNode const& arg)
+{
+  using gandiva::TreeExprBuilder;
+  auto type = arrowType(arg.type);
+  auto zero = makeLiteral(0, arg.type);
+  auto negative = TreeExprBuilder::MakeFunction("less_than", {arg.node, zero}, arrow::boolean());
+  auto opposite = TreeExprBuilder::MakeFunction("subtract", {zero, arg.node}, type);
+  return TypedNode{TreeExprBuilder::MakeIf(negative, opposite, arg.node, type), arg.type};
+}
+
+/// sqrt(x), as exp(0.5 * log(x)), of a double @a arg.
+TypedNode makeSqrt(TypedNode const& arg)
+{
+  using gandiva::TreeExprBuilder;
+  auto type = arrow::float64();
+  auto logArg = TreeExprBuilder::MakeFunction("log", {arg.node}, type);
+  auto half = TreeExprBuilder::MakeFunction("multiply", {TreeExprBuilder::MakeLiteral(0.5), logArg}, type);
+  return TypedNode{TreeExprBuilder::MakeFunction("exp", {half}, type), atype::DOUBLE};
+}
+
+std::string literalToString(LiteralNode::var_t const& value)
+{
+  return std::visit(
+    [](auto v) {
+      using T = decltype(v);
+      char buffer[64];
+      if constexpr (std::is_same_v<T, bool>) {
+        snprintf(buffer, sizeof(buffer), "b%d", v ? 1 : 0);
+      } else if constexpr (std::is_same_v<T, int>) {
+        snprintf(buffer, sizeof(buffer), "i%d", v);
+      } else if constexpr (std::is_same_v<T, float>) {
+        snprintf(buffer, sizeof(buffer), "f%a", static_cast<double>(v));
+      } else {
+        snprintf(buffer, sizeof(buffer), "d%a", v);
+      }
+      return std::string{buffer};
+    },
+    value);
+}
+
+std::string datumToString(DatumSpec const& datum)
+{
+  if (auto index = std::get_if<size_t>(&datum)) {
+    return "#" + std::to_string(*index);
+  }
+  if (auto literal = std::get_if<LiteralNode::var_t>(&datum)) {
+    return literalToString(*literal);
+  }
+  if (auto column = std::get_if<std::string>(&datum)) {
+    return "'" + *column + "'";
+  }
+  return "-";
+}
+
+std::string schemaFingerprint(gandiva::SchemaPtr const& schema)
+{
+  std::string fingerprint;
+  for (auto& field : schema->fields()) {
+    fingerprint += field->name() + ":" + field->type()->ToString() + (field->nullable() ? "?;" : ";");
+  }
+  if (auto metadata = schema->metadata()) {
+    for (int64_t i = 0; i < metadata->size(); ++i) {
+      fingerprint += metadata->key(i) + "=" + metadata->value(i) + ";";
+    }
+  }
+  return fingerprint;
+}
+} // namespace
+
+Operations createOperations(Filter const& expression)
+{
+  Operations ops;
+  auto root = flatten(*expression.node, ops);
+  if (std::holds_alternative<size_t>(root) == false) {
+    throw std::runtime_error("A filter expression needs at least one operation");
+  }
+  return ops;
+}
+
+bool isSchemaCompatible(gandiva::SchemaPtr const& Schema, Operations const& opSpecs)
+{
+  for (auto& spec : opSpecs) {
+    for (auto datum : {&spec.left, &spec.right}) {
+      auto column = std::get_if<std::string>(datum);
+      if (column && Schema->GetFieldByName(*column) == nullptr) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+gandiva::NodePtr createExpressionTree(Operations const& opSpecs,
+                                      gandiva::SchemaPtr const& Schema)
+{
+  std::vector<TypedNode> results;
+  results.reserve(opSpecs.size());
+  // Literals take the type of the other operand, columns and results of
+  // other operations are promoted to the widest of the two types.
+  auto operand = [&](DatumSpec const& datum, DatumSpec const& other) -> TypedNode {
+    if (auto index = std::get_if<size_t>(&datum)) {
+      return results.at(*index);
+    }
+    if (auto column = std::get_if<std::string>(&datum)) {
+      auto field = Schema->GetFieldByName(*column);
+      if (field == nullptr) {
+        throw std::runtime_error("Unknown column " + *column + " in filter expression");
+      }
+      return TypedNode{gandiva::TreeExprBuilder::MakeField(field), field->type()->id()};
+    }
+    auto const& literal = std::get<LiteralNode::var_t>(datum);
+    atype::type type = literalType(literal);
+    if (auto index = std::get_if<size_t>(&other)) {
+      type = results.at(*index).type;
+    } else if (auto column = std::get_if<std::string>(&other)) {
+      if (auto field = Schema->GetFieldByName(*column)) {
+        type = field->type()->id();
+      }
+    }
+    return TypedNode{makeLiteral(literal, type), type};
+  };
+
+  for (auto& spec : opSpecs) {
+    if (spec.op == BasicOp::Abs) {
+      results.push_back(makeAbs(operand(spec.left, spec.right)));
+      continue;
+    }
+    if (isUnary(spec.op)) {
+      // The other functions are only available in double precision.
+      auto arg = promote(operand(spec.left, spec.right), atype::DOUBLE);
+      if (spec.op == BasicOp::Sqrt) {
+        results.push_back(makeSqrt(arg));
+        continue;
+      }
+      results.push_back({gandiva::TreeExprBuilder::MakeFunction(gandivaFunction(spec.op), {arg.node}, arrowType(arg.type)),
+                         arg.type});
+      continue;
+    }
+    auto left = operand(spec.left, spec.right);
+    auto right = operand(spec.right, spec.left);
+    if (spec.op == BasicOp::LogicalAnd) {
+      results.push_back({gandiva::TreeExprBuilder::MakeAnd({left.node, right.node}), atype::BOOL});
+      continue;
+    }
+    if (spec.op == BasicOp::LogicalOr) {
+      results.push_back({gandiva::TreeExprBuilder::MakeOr({left.node, right.node}), atype::BOOL});
+      continue;
+    }
+    if (left.type != right.type) {
+      auto type = typeRank(left.type) >= typeRank(right.type) ? left.type : right.type;
+      left = promote(left, type);
+      right = promote(right, type);
+    }
+    auto resultType = isComparison(spec.op) ? atype::BOOL : left.type;
+    results.push_back({gandiva::TreeExprBuilder::MakeFunction(gandivaFunction(spec.op),
+                                                              {left.node, right.node},
+                                                              arrowType(resultType)),
+                       resultType});
+  }
+  return results.back().node;
+}
+
+std::shared_ptr<gandiva::Filter> createFilter(gandiva::SchemaPtr const& Schema,
+                                              gandiva::ConditionPtr condition)
+{
+  std::shared_ptr<gandiva::Filter> filter;
+  auto status = gandiva::Filter::Make(Schema, condition, &filter);
+  if (status.ok() == false) {
+    throw std::runtime_error("Unable to create filter: " + status.ToString());
+  }
+  return filter;
+}
+
+std::string canonicalForm(Operations const& opSpecs)
+{
+  std::string form;
+  for (size_t i = 0; i < opSpecs.size(); ++i) {
+    auto& spec = opSpecs[i];
+    form += "#" + std::to_string(i) + "=" + std::to_string(static_cast<unsigned int>(spec.op)) + "(" +
+            datumToString(spec.left) + "," + datumToString(spec.right) + ");";
+  }
+  return form;
+}
+
+std::shared_ptr<gandiva::Filter> cachedFilter(gandiva::SchemaPtr const& Schema,
+                                              Operations const& opSpecs)
+{
+  auto key = schemaFingerprint(Schema) + "|" + canonicalForm(opSpecs);
+  std::lock_guard<std::mutex> lock(gFilterCacheMutex);
+  auto it = gFilterCache.find(key);
+  if (it != gFilterCache.end()) {
+    ++gFilterCacheStats.hits;
+    return it->second;
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto condition = gandiva::TreeExprBuilder::MakeCondition(createExpressionTree(opSpecs, Schema));
+  auto filter = createFilter(Schema, condition);
+  gFilterCacheStats.jitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  ++gFilterCacheStats.misses;
+  gFilterCache.emplace(std::move(key), filter);
+  return filter;
+}
+
+FilterCacheStats filterCacheStats()
+{
+  std::lock_guard<std::mutex> lock(gFilterCacheMutex);
+  return gFilterCacheStats;
+}
+
+Selection createSelection(std::shared_ptr<arrow::Table> table, Filter const& expression)
+{
+  auto filter = cachedFilter(table->schema(), createOperations(expression));
+  Selection selection;
+  auto status = gandiva::SelectionVector::MakeInt64(table->num_rows(), arrow::default_memory_pool(), &selection);
+  if (status.ok() == false) {
+    throw std::runtime_error("Unable to allocate selection: " + status.ToString());
+  }
+
+  // Gandiva works on record batches, whose selected rows are relative to the
+  // batch, so they are shifted to table rows.
+  arrow::TableBatchReader reader(*table);
+  std::shared_ptr<arrow::RecordBatch> batch;
+  int64_t selected = 0;
+  int64_t offset = 0;
+  while (true) {
+    status = reader.ReadNext(&batch);
+    if (status.ok() == false) {
+      throw std::runtime_error("Unable to read table: " + status.ToString());
+    }
+    if (batch == nullptr) {
+      break;
+    }
+    Selection batchSelection;
+    status = gandiva::SelectionVector::MakeInt64(batch->num_rows(), arrow::default_memory_pool(), &batchSelection);
+    if (status.ok()) {
+      status = filter->Evaluate(*batch, batchSelection);
+    }
+    if (status.ok() == false) {
+      throw std::runtime_error("Unable to evaluate filter: " + status.ToString());
+    }
+    for (int64_t i = 0; i < batchSelection->GetNumSlots(); ++i) {
+      selection->SetIndex(selected++, offset + batchSelection->GetIndex(i));
+    }
+    offset += batch->num_rows();
+  }
+  selection->SetNumSlots(selected);
+  return selection;
+}
+
+} // namespace o2::framework::expressions
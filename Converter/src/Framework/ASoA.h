@@ -17,8 +17,18 @@
 #include "Framework/Expressions.h"
 #include <arrow/table.h>
 #include <arrow/array.h>
+#include <arrow/array/concatenate.h>
+#include <arrow/buffer.h>
+#include <arrow/memory_pool.h>
 #include <gandiva/selection_vector.h>
+#include <algorithm>
 #include <cassert>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace o2::soa
 {
@@ -84,9 +94,11 @@ struct Flat {
 };
 
 /// Iterator on a single column.
-/// FIXME: the ChunkingPolicy for now is fixed to Flat and is a mere boolean
-/// which is used to switch off slow "chunking aware" parts. This is ok for
-/// now, but most likely we should move the whole chunk navigation logic there.
+/// The ChunkingPolicy is a mere boolean which is used to switch off the slow
+/// "chunking aware" parts at compile time. The columns of a RowView are
+/// Chunked. Flat iterators are only bound to single chunk columns, see
+/// Table::flatColumn(), and are indexed directly with operator[], so that
+/// loops over them are plain pointer arithmetic.
 template <typename T, typename ChunkingPolicy = Chunked>
 class ColumnIterator : ChunkingPolicy
 {
@@ -95,16 +107,32 @@ class ColumnIterator : ChunkingPolicy
   /// to the arrow::Column (for the data store) and to the index inside
   /// it. This means that a ColumnIterator is actually only available
   /// as part of a RowView.
-  ColumnIterator(arrow::Column const* column)
+  ColumnIterator(arrow::Column const* column, char const* label = "")
     : mColumn{column},
       mCurrentPos{nullptr},
       mFirstIndex{0},
-      mCurrentChunk{0}
-  {
+      mCurrentChunk{0},
+      mLabel{label}
+  {
+    // Columns which are not stored (e.g. fCollisionsID when replaced by
+    // collision ranges) and empty slices are left unbound. Dereferencing
+    // them always ends up in seek(), which throws.
+    if (mColumn == nullptr || mColumn->data()->num_chunks() == 0) {
+      mCurrent = mLast = nullptr;
+      return;
+    }
     auto chunks = mColumn->data();
-    auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    mCurrent = array->raw_values();
-    mLast = mCurrent + array->length();
+    if constexpr (ChunkingPolicy::chunked) {
+      mChunks = std::make_shared<ChunkIndex>(*chunks);
+      setChunk(0);
+    } else {
+      if (chunks->num_chunks() != 1) {
+        throw std::runtime_error(std::string("Column ") + mLabel + " is made of several chunks");
+      }
+      auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(0));
+      mCurrent = array->raw_values();
+      mLast = mCurrent + array->length();
+    }
   }
 
   ColumnIterator() = default;
@@ -117,91 +145,129 @@ class ColumnIterator : ChunkingPolicy
   /// Move the iterator to the next chunk.
   void nextChunk() const
   {
-    auto chunks = mColumn->data();
-    auto previousArray = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    mFirstIndex += previousArray->length();
-    mCurrentChunk++;
-    auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    mCurrent = array->raw_values() - mFirstIndex;
-    mLast = mCurrent + array->length() + mFirstIndex;
+    setChunk(mCurrentChunk + 1);
   }
 
   void prevChunk() const
   {
-    auto chunks = mColumn->data();
-    auto previousArray = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    mFirstIndex -= previousArray->length();
-    mCurrentChunk--;
-    auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    mCurrent = array->raw_values() - mFirstIndex;
-    mLast = mCurrent + array->length() + mFirstIndex;
+    setChunk(mCurrentChunk - 1);
   }
 
   void moveToChunk(int chunk)
   {
-    if (mCurrentChunk < chunk) {
-      while (mCurrentChunk != chunk) {
-        nextChunk();
-      }
-    } else {
-      while (mCurrentChunk != chunk) {
-        prevChunk();
-      }
+    setChunk(chunk);
+  }
+
+  /// Move the iterator to the chunk holding row @a pos, in O(log(chunks)).
+  void seek(int64_t pos) const
+  {
+    if (O2_BUILTIN_UNLIKELY(mChunks == nullptr)) {
+      unbound();
     }
+    setChunk(mChunks->chunkFor(pos));
   }
 
   /// Move the iterator to the end of the column.
   void moveToEnd()
   {
-    mCurrentChunk = mColumn->data()->num_chunks() - 1;
-    auto chunks = mColumn->data();
-    auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunks->chunk(mCurrentChunk));
-    assert(array.get());
-    mFirstIndex = mColumn->length() - array->length();
-    mCurrent = array->raw_values() - mFirstIndex;
-    mLast = mCurrent + array->length() + mFirstIndex;
+    if (mChunks) {
+      setChunk(mChunks->values.size() - 1);
+    }
   }
 
   T const& operator*() const
   {
     if constexpr (ChunkingPolicy::chunked) {
-      if (O2_BUILTIN_UNLIKELY(((mCurrent + *mCurrentPos) >= mLast))) {
-        nextChunk();
+      if (O2_BUILTIN_UNLIKELY(outsideChunk())) {
+        seek(*mCurrentPos);
       }
     }
     return *(mCurrent + *mCurrentPos);
   }
 
+  /// Value of row @a pos, without any chunk navigation: Flat iterators only.
+  T const& operator[](int64_t pos) const
+  {
+    static_assert(!ChunkingPolicy::chunked, "Chunked iterators follow the row of their RowView");
+    return mCurrent[pos];
+  }
+
   // Move to the chunk which containts element pos
-  ColumnIterator<T>& moveToPos()
+  ColumnIterator<T, ChunkingPolicy>& moveToPos()
   {
-    // If we get outside range of the current chunk, go to the next.
     if constexpr (ChunkingPolicy::chunked) {
-      while (O2_BUILTIN_UNLIKELY((mCurrent + *mCurrentPos) >= mLast)) {
-        nextChunk();
+      if (O2_BUILTIN_UNLIKELY(outsideChunk())) {
+        seek(*mCurrentPos);
       }
     }
     return *this;
   }
 
   // Move to the chunk which containts element pos
-  ColumnIterator<T>& checkNextChunk()
-  {
-    if constexpr (ChunkingPolicy::chunked) {
-      if (O2_BUILTIN_LIKELY((mCurrent + *mCurrentPos) <= mLast)) {
-        return *this;
+  ColumnIterator<T, ChunkingPolicy>& checkNextChunk()
+  {
+    return moveToPos();
+  }
+
+  /// Cumulative lengths and raw values of the chunks of a column, built once
+  /// per column and shared by all the copies of its iterator, so that moving
+  /// to an arbitrary row is a binary search rather than a walk over the
+  /// chunks.
+  struct ChunkIndex {
+    explicit ChunkIndex(arrow::ChunkedArray const& chunks)
+    {
+      offsets.reserve(chunks.num_chunks() + 1);
+      values.reserve(chunks.num_chunks());
+      offsets.push_back(0);
+      for (auto& chunk : chunks.chunks()) {
+        auto array = std::static_pointer_cast<arrow_array_for_t<T>>(chunk);
+        values.push_back(array->raw_values());
+        offsets.push_back(offsets.back() + array->length());
       }
-      nextChunk();
     }
-    return *this;
-  }
+
+    /// The chunk holding row @a pos. Rows past the end belong to the last
+    /// chunk, which is where the end iterator lives.
+    int chunkFor(int64_t pos) const
+    {
+      auto it = std::upper_bound(offsets.begin() + 1, offsets.end() - 1, pos);
+      return it - (offsets.begin() + 1);
+    }
+
+    std::vector<int64_t> offsets;
+    std::vector<T const*> values;
+  };
 
   mutable T const* mCurrent;
   int64_t const* mCurrentPos;
   mutable T const* mLast;
   arrow::Column const* mColumn;
-  mutable int mFirstIndex;
+  mutable int64_t mFirstIndex;
   mutable int mCurrentChunk;
+  std::shared_ptr<ChunkIndex const> mChunks;
+  char const* mLabel = "";
+
+ private:
+  [[noreturn]] void unbound() const
+  {
+    if (mColumn == nullptr) {
+      throw std::runtime_error(std::string("Column ") + mLabel + " is not in the table");
+    }
+    throw std::runtime_error(std::string("Row out of range of the empty column ") + mLabel);
+  }
+
+  bool outsideChunk() const
+  {
+    return (mCurrent + *mCurrentPos) >= mLast || *mCurrentPos < mFirstIndex;
+  }
+
+  void setChunk(int chunk) const
+  {
+    mCurrentChunk = chunk;
+    mFirstIndex = mChunks->offsets[chunk];
+    mCurrent = mChunks->values[chunk] - mFirstIndex;
+    mLast = mChunks->values[chunk] + (mChunks->offsets[chunk + 1] - mFirstIndex);
+  }
 };
 
 template <typename T, typename INHERIT>
@@ -616,6 +682,132 @@ struct ArrowHelpers {
   static std::shared_ptr<arrow::Table> concatTables(std::vector<std::shared_ptr<arrow::Table>>&& tables);
 };
 
+/// All the values of the column @a label of @a table, of arrow type ARRAY.
+template <typename ARRAY>
+std::vector<typename ARRAY::value_type> columnValues(arrow::Table const& table, char const* label)
+{
+  std::vector<typename ARRAY::value_type> values;
+  auto index = table.schema()->GetFieldIndex(label);
+  if (index < 0) {
+    throw std::runtime_error(std::string("Missing column ") + label);
+  }
+  values.reserve(table.num_rows());
+  for (auto& chunk : table.column(index)->data()->chunks()) {
+    auto array = std::static_pointer_cast<ARRAY>(chunk);
+    values.insert(values.end(), array->raw_values(), array->raw_values() + array->length());
+  }
+  return values;
+}
+
+/// O(1) lookup of the rows of a table belonging to a given collision, out of
+/// one of the offset + count index tables (e.g. aod::TrackRanges). Rows must
+/// be grouped by collision, which is what the converter produces.
+class CollisionRanges
+{
+ public:
+  CollisionRanges(arrow::Table const& ranges)
+  {
+    auto ids = columnValues<arrow::Int32Array>(ranges, "fCollisionsID");
+    auto offsets = columnValues<arrow::Int64Array>(ranges, "fOffset");
+    auto counts = columnValues<arrow::Int64Array>(ranges, "fCount");
+    for (size_t i = 0; i < ids.size(); ++i) {
+      if (ids[i] < 0) {
+        throw std::runtime_error("Invalid collision id in collision ranges");
+      }
+      if (static_cast<size_t>(ids[i]) >= mRanges.size()) {
+        mRanges.resize(ids[i] + 1, {0, 0});
+      }
+      if (mRanges[ids[i]].second != 0) {
+        throw std::runtime_error("Rows are not grouped by collision");
+      }
+      mRanges[ids[i]] = {offsets[i], counts[i]};
+    }
+  }
+
+  /// First row and number of rows of collision @a collisionId. Collisions
+  /// without any row get an empty range.
+  std::pair<int64_t, int64_t> operator[](int32_t collisionId) const
+  {
+    if (collisionId < 0 || static_cast<size_t>(collisionId) >= mRanges.size()) {
+      return {0, 0};
+    }
+    return mRanges[collisionId];
+  }
+
+  /// One past the largest collision id with at least one row.
+  size_t size() const
+  {
+    return mRanges.size();
+  }
+
+ private:
+  std::vector<std::pair<int64_t, int64_t>> mRanges;
+};
+
+/// Memoized results of materialize() for a table, see
+/// Table::enableColumnCache(). The arrays are keyed by column label and kept
+/// until evicted.
+class MaterializedColumnCache
+{
+ public:
+  std::shared_ptr<arrow::Array> find(std::string const& label) const
+  {
+    auto it = mColumns.find(label);
+    return it == mColumns.end() ? nullptr : it->second;
+  }
+
+  void insert(std::string const& label, std::shared_ptr<arrow::Array> array)
+  {
+    evict(label);
+    mBytes += arrayBytes(*array);
+    mColumns.emplace(label, std::move(array));
+  }
+
+  /// Drops the cached column @a label, if any.
+  void evict(std::string const& label)
+  {
+    auto it = mColumns.find(label);
+    if (it != mColumns.end()) {
+      mBytes -= arrayBytes(*it->second);
+      mColumns.erase(it);
+    }
+  }
+
+  /// Drops all the cached columns.
+  void evict()
+  {
+    mColumns.clear();
+    mBytes = 0;
+  }
+
+  /// Bytes held by the cached columns.
+  int64_t bytes() const
+  {
+    return mBytes;
+  }
+
+  std::map<std::string, std::shared_ptr<arrow::Array>> const& columns() const
+  {
+    return mColumns;
+  }
+
+ private:
+  static int64_t arrayBytes(arrow::Array const& array)
+  {
+    int64_t bytes = 0;
+    for (auto& buffer : array.data()->buffers) {
+      bytes += buffer ? buffer->size() : 0;
+    }
+    return bytes;
+  }
+
+  std::map<std::string, std::shared_ptr<arrow::Array>> mColumns;
+  int64_t mBytes = 0;
+};
+
+template <typename DC, typename T>
+std::shared_ptr<arrow::Array> materialize(T const& table);
+
 /// A Table class which observes an arrow::Table and provides
 /// It is templated on a set of Column / DynamicColumn types.
 template <typename... C>
@@ -630,6 +822,9 @@ class Table
   using columns = framework::pack<C...>;
   using persistent_columns_t = framework::selected_pack<is_persistent_t, C...>;
 
+  /// Persistent columns missing from @a table (e.g. fCollisionsID when the
+  /// converter wrote collision ranges instead) are left unbound: accessing
+  /// them throws.
   Table(std::shared_ptr<arrow::Table> table)
     : mTable(table),
       mColumnIndex{
@@ -687,6 +882,115 @@ class Table
     return mTable->num_rows();
   }
 
+  /// Whether all the columns are made of a single chunk, so that Flat
+  /// iterators can be bound to them, see flatColumn().
+  bool isFlat() const
+  {
+    for (int ci = 0; ci < mTable->num_columns(); ++ci) {
+      if (mTable->column(ci)->data()->num_chunks() > 1) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// A copy of this table where each column is concatenated into a single
+  /// chunk (e.g. after reading several record batches), so that Flat
+  /// iterators can be bound to it. Flat tables are returned as they are.
+  table_t combineChunks() const
+  {
+    if (isFlat()) {
+      return table_t{mTable};
+    }
+    std::vector<std::shared_ptr<arrow::Column>> columns;
+    for (int ci = 0; ci < mTable->num_columns(); ++ci) {
+      auto column = mTable->column(ci);
+      std::shared_ptr<arrow::Array> array;
+      auto status = arrow::Concatenate(column->data()->chunks(), arrow::default_memory_pool(), &array);
+      if (status.ok() == false) {
+        throw std::runtime_error("Unable to combine the chunks of " + column->name());
+      }
+      columns.push_back(std::make_shared<arrow::Column>(column->field(), array));
+    }
+    return table_t{arrow::Table::Make(mTable->schema(), columns, mTable->num_rows())};
+  }
+
+  /// A Flat iterator on the persistent column CC, whose values are read with
+  /// plain pointer arithmetic rather than through a RowView, e.g. in loops
+  /// which vectorize. CC must be made of a single chunk (see
+  /// combineChunks()) and the iterator is valid as long as the table is.
+  template <typename CC>
+  ColumnIterator<typename CC::type, Flat> flatColumn() const
+  {
+    auto index = mTable->schema()->GetFieldIndex(CC::label());
+    if (index < 0) {
+      throw std::runtime_error(std::string("Column ") + CC::label() + " is not in the table");
+    }
+    return ColumnIterator<typename CC::type, Flat>{mTable->column(index).get(), CC::label()};
+  }
+
+  /// Opt-in memoization of materialized(), i.e. of the dynamic columns
+  /// evaluated in bulk. Copies of the table made afterwards share the cache.
+  /// Nothing else uses it: the row getters evaluate the dynamic columns per
+  /// row, and filters evaluate their expressions (see soa::expression()) on
+  /// the table as it is.
+  void enableColumnCache()
+  {
+    if (!mCache) {
+      mCache = std::make_shared<MaterializedColumnCache>();
+    }
+  }
+
+  /// The values of the dynamic column DC over the whole table, see
+  /// soa::materialize(). With the column cache enabled they are computed
+  /// only the first time.
+  template <typename DC>
+  std::shared_ptr<arrow::Array> materialized() const
+  {
+    if (!mCache) {
+      return materialize<DC>(*this);
+    }
+    auto array = mCache->find(DC::mLabel);
+    if (!array) {
+      array = materialize<DC>(*this);
+      mCache->insert(DC::mLabel, array);
+    }
+    return array;
+  }
+
+  /// Bytes held by the cached columns.
+  int64_t cachedBytes() const
+  {
+    return mCache ? mCache->bytes() : 0;
+  }
+
+  /// Drops the cached column of DC, or all of them when no column is given.
+  template <typename DC = void>
+  void evictCachedColumns()
+  {
+    if (!mCache) {
+      return;
+    }
+    if constexpr (std::is_void_v<DC>) {
+      mCache->evict();
+    } else {
+      mCache->evict(DC::mLabel);
+    }
+  }
+
+  /// The @a count rows starting at @a offset, without copying.
+  table_t slice(int64_t offset, int64_t count) const
+  {
+    return table_t{mTable->Slice(offset, count)};
+  }
+
+  /// The rows of collision @a collisionId, according to @a ranges.
+  table_t sliceByCollision(CollisionRanges const& ranges, int32_t collisionId) const
+  {
+    auto [offset, count] = ranges[collisionId];
+    return slice(offset, count);
+  }
+
  private:
   template <typename T>
   arrow::Column* lookupColumn()
@@ -694,12 +998,17 @@ class Table
     if constexpr (T::persistent::value) {
       auto label = T::label();
       auto index = mTable->schema()->GetFieldIndex(label);
+      if (index < 0) {
+        return nullptr;
+      }
       return mTable->column(index).get();
     } else {
       return nullptr;
     }
   }
   std::shared_ptr<arrow::Table> mTable;
+  /// Materialized dynamic columns, if enabled.
+  std::shared_ptr<MaterializedColumnCache> mCache;
   /// This is a cached lookup of the column index in a given
   std::tuple<std::pair<C*, arrow::Column*>...> mColumnIndex;
   /// Cached begin iterator for this table.
@@ -708,6 +1017,249 @@ class Table
   iterator mEnd;
 };
 
+/// View of a table whose rows are grouped (e.g. the tracks of each
+/// collision), given the first row and the number of rows of every group.
+/// Each group is handed out as a pair of iterators on the whole table, whose
+/// range is restricted with limitRange(), so no searching nor copying is
+/// involved:
+///
+/// \code{.cpp}
+/// GroupedTable<aod::Tracks> grouped{tracks, *groups, "fFirstTrack", "fNTracks"};
+/// for (auto collisionTracks : grouped) {
+///   for (auto& track : collisionTracks) {
+///     ...
+///   }
+/// }
+/// \endcode
+template <typename T>
+class GroupedTable
+{
+ public:
+  using iterator = typename T::iterator;
+
+  /// The rows of a single group.
+  class Group
+  {
+   public:
+    Group(iterator const& begin, iterator const& end)
+      : mBegin{begin},
+        mEnd{end}
+    {
+    }
+
+    iterator begin() const
+    {
+      return mBegin;
+    }
+
+    iterator end() const
+    {
+      return mEnd;
+    }
+
+   private:
+    iterator mBegin;
+    iterator mEnd;
+  };
+
+  class GroupIterator
+  {
+   public:
+    GroupIterator(GroupedTable<T> const* grouped, size_t index)
+      : mGrouped{grouped},
+        mIndex{index}
+    {
+    }
+
+    Group operator*() const
+    {
+      return mGrouped->group(mIndex);
+    }
+
+    GroupIterator& operator++()
+    {
+      ++mIndex;
+      return *this;
+    }
+
+    bool operator!=(GroupIterator const& other) const
+    {
+      return mIndex != other.mIndex;
+    }
+
+   private:
+    GroupedTable<T> const* mGrouped;
+    size_t mIndex;
+  };
+
+  GroupedTable(T const& table, std::vector<int64_t> firsts, std::vector<int64_t> counts)
+    : mTable{table},
+      mFirsts{std::move(firsts)},
+      mCounts{std::move(counts)}
+  {
+    if (mFirsts.size() != mCounts.size()) {
+      throw std::runtime_error("Mismatching number of group offsets and counts");
+    }
+    for (size_t i = 0; i < mFirsts.size(); ++i) {
+      if (mFirsts[i] < 0 || mCounts[i] < 0 || mFirsts[i] + mCounts[i] > mTable.size()) {
+        throw std::runtime_error("Group outside of the grouped table");
+      }
+    }
+  }
+
+  /// Takes the offsets and counts from the @a firstLabel and @a countLabel
+  /// columns of @a groups, e.g. aod::CollisionGroups.
+  GroupedTable(T const& table, arrow::Table const& groups, char const* firstLabel, char const* countLabel)
+    : GroupedTable(table,
+                   columnValues<arrow::Int64Array>(groups, firstLabel),
+                   columnValues<arrow::Int64Array>(groups, countLabel))
+  {
+  }
+
+  /// The rows of group @a i.
+  Group group(size_t i) const
+  {
+    iterator begin = mTable.begin();
+    begin.limitRange(mFirsts[i], mFirsts[i] + mCounts[i]);
+    iterator end = begin;
+    end.moveToEnd();
+    return Group{begin, end};
+  }
+
+  GroupIterator begin() const
+  {
+    return GroupIterator{this, 0};
+  }
+
+  GroupIterator end() const
+  {
+    return GroupIterator{this, mFirsts.size()};
+  }
+
+  /// Number of groups.
+  size_t size() const
+  {
+    return mFirsts.size();
+  }
+
+ private:
+  T mTable;
+  std::vector<int64_t> mFirsts;
+  std::vector<int64_t> mCounts;
+};
+
+/// Float kernel evaluating, on whole arrays, the dynamic columns whose
+/// callback holder (the _Name_##Callback of DECLARE_SOA_DYNAMIC_COLUMN) is
+/// CALLBACK. Specializations provide:
+///
+/// - `using type = ...;`, the type of the materialized values;
+/// - `static type compute(...)`, taking the values of the bound columns and
+///   written so that loops over it vectorize (see FastMath.h).
+///
+/// Without specialization materialize() evaluates the lambda of the column.
+template <typename CALLBACK>
+struct VectorizedCallback {
+  constexpr static bool available = false;
+};
+
+namespace detail
+{
+/// The column @a label of @a table as a single chunk, concatenating its
+/// chunks only if there are several of them.
+inline std::shared_ptr<arrow::Column> singleChunkColumn(arrow::Table const& table, char const* label)
+{
+  auto index = table.schema()->GetFieldIndex(label);
+  if (index < 0) {
+    throw std::runtime_error(std::string("Missing column ") + label);
+  }
+  auto column = table.column(index);
+  if (column->data()->num_chunks() == 1) {
+    return column;
+  }
+  std::shared_ptr<arrow::Array> array;
+  auto status = arrow::Concatenate(column->data()->chunks(), arrow::default_memory_pool(), &array);
+  if (status.ok() == false) {
+    throw std::runtime_error(std::string("Unable to combine the chunks of ") + label);
+  }
+  return std::make_shared<arrow::Column>(column->field(), array);
+}
+
+template <typename DC, typename... B>
+std::shared_ptr<arrow::Array> materializeHelper(arrow::Table const& table, framework::pack<B...>)
+{
+  using vectorized_t = VectorizedCallback<typename DC::callback_holder_t>;
+  using result_t = typename std::conditional_t<vectorized_t::available, vectorized_t, DC>::type;
+  auto const nRows = table.num_rows();
+  std::shared_ptr<arrow::Buffer> buffer;
+  if (arrow::AllocateBuffer(arrow::default_memory_pool(), nRows * sizeof(result_t), &buffer).ok() == false) {
+    throw std::runtime_error(std::string("Unable to allocate ") + DC::mLabel);
+  }
+  auto output = reinterpret_cast<result_t*>(buffer->mutable_data());
+  auto compute = [nRows, output](ColumnIterator<typename B::type, Flat>... inputs) {
+    for (int64_t i = 0; i < nRows; ++i) {
+      if constexpr (vectorized_t::available) {
+        output[i] = vectorized_t::compute(inputs[i]...);
+      } else {
+        output[i] = DC::callback_holder_t::getLambda()(inputs[i]...);
+      }
+    }
+  };
+  if (nRows != 0) {
+    // Only the bound columns are made flat, the others are not touched.
+    auto bind = [&compute](auto const&... column) {
+      compute(ColumnIterator<typename B::type, Flat>{column.get(), B::label()}...);
+    };
+    std::apply(bind, std::make_tuple(singleChunkColumn(table, B::label())...));
+  }
+  return std::make_shared<arrow_array_for_t<result_t>>(nRows, buffer);
+}
+} // namespace detail
+
+/// Evaluates the dynamic column DC (e.g. aod::track::Eta<aod::track::Tgl>)
+/// over all the rows of @a table in a single pass on the raw values of the
+/// bound columns, rather than row by row through a RowView. The result is a
+/// single chunk Arrow array, to be reused (e.g. histogrammed) many times.
+/// Bound columns made of several chunks are concatenated first.
+/// Columns with a VectorizedCallback get its float kernel, which is
+/// approximate, others get their lambda.
+template <typename DC, typename T>
+std::shared_ptr<arrow::Array> materialize(T const& table)
+{
+  return detail::materializeHelper<DC>(*table.asArrowTable(), typename DC::bindings_t{});
+}
+
+/// Translation of the dynamic columns whose callback holder is CALLBACK into
+/// filter expressions, so that they can be evaluated by Gandiva rather than
+/// row by row. Specializations provide:
+///
+/// - `static framework::expressions::Node compute(...)`, taking one node per
+///   bound column and building the expression of the lambda with the
+///   operators and functions (nabs, nlog, ...) of Expressions.h.
+template <typename CALLBACK>
+struct DynamicColumnExpression {
+  constexpr static bool available = false;
+};
+
+namespace detail
+{
+template <typename DC, typename... B>
+framework::expressions::Node expressionHelper(framework::pack<B...>)
+{
+  using expression_t = DynamicColumnExpression<typename DC::callback_holder_t>;
+  static_assert(expression_t::available, "No DynamicColumnExpression for this dynamic column");
+  return expression_t::compute(framework::expressions::Node{
+    framework::expressions::BindingNode{B::label(), framework::expressions::selectArrowType<typename B::type>()}}...);
+}
+} // namespace detail
+
+/// The filter expression of the dynamic column DC (e.g.
+/// aod::track::Pt<aod::track::Signed1Pt>), in terms of its bound columns.
+template <typename DC>
+framework::expressions::Node expression()
+{
+  return detail::expressionHelper<DC>(typename DC::bindings_t{});
+}
+
 template <typename T>
 struct PackToTable {
   static_assert(framework::always_static_assert_v<T>, "Not a pack");
@@ -756,7 +1308,8 @@ class TableMetadata
     using type = _Type_;                                                       \
     using column_t = _Name_;                                                   \
     _Name_(arrow::Column const* column)                                        \
-      : o2::soa::Column<_Type_, _Name_>(o2::soa::ColumnIterator<type>(column)) \
+      : o2::soa::Column<_Type_, _Name_>(                                       \
+          o2::soa::ColumnIterator<type>(column, _Label_))                      \
     {                                                                          \
     }                                                                          \
                                                                                \
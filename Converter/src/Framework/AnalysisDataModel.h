@@ -11,6 +11,7 @@
 #define O2_FRAMEWORK_ANALYSISDATAMODEL_H_
 
 #include "Framework/ASoA.h"
+#include "Framework/FastMath.h"
 #include <cmath>
 
 namespace o2
@@ -144,6 +145,41 @@ DECLARE_SOA_TABLE(Muons, "AOD", "MUON",
                   muon::Chi2, muon::Chi2MatchTrigger);
 using Muon = Muons::iterator;
 
+// Offset + count of the rows of each collision. These tables replace the
+// fCollisionsID column of the tracks (TRACKPARCOV and TRACKEXTRA being row
+// aligned with TRACKPAR), calo cells and muons when the converter is run with
+// --collision-ranges. Each table has its own columns, so that the table
+// types, and thus their metadata, differ.
+namespace trackrange
+{
+DECLARE_SOA_COLUMN(CollisionId, collisionId, int32_t, "fCollisionsID");
+DECLARE_SOA_COLUMN(Offset, offset, int64_t, "fOffset");
+DECLARE_SOA_COLUMN(Count, count, int64_t, "fCount");
+} // namespace trackrange
+
+DECLARE_SOA_TABLE(TrackRanges, "AOD", "TRACKPARRANGE",
+                  trackrange::CollisionId, trackrange::Offset, trackrange::Count);
+
+namespace calorange
+{
+DECLARE_SOA_COLUMN(CollisionId, collisionId, int32_t, "fCollisionsID");
+DECLARE_SOA_COLUMN(Offset, offset, int64_t, "fOffset");
+DECLARE_SOA_COLUMN(Count, count, int64_t, "fCount");
+} // namespace calorange
+
+DECLARE_SOA_TABLE(CaloRanges, "AOD", "CALORANGE",
+                  calorange::CollisionId, calorange::Offset, calorange::Count);
+
+namespace muonrange
+{
+DECLARE_SOA_COLUMN(CollisionId, collisionId, int32_t, "fCollisionsID");
+DECLARE_SOA_COLUMN(Offset, offset, int64_t, "fOffset");
+DECLARE_SOA_COLUMN(Count, count, int64_t, "fCount");
+} // namespace muonrange
+
+DECLARE_SOA_TABLE(MuonRanges, "AOD", "MUONRANGE",
+                  muonrange::CollisionId, muonrange::Offset, muonrange::Count);
+
 namespace muoncluster
 {
 DECLARE_SOA_COLUMN(TrackId, trackId, int, "fMuTrackID");
@@ -241,6 +277,25 @@ DECLARE_SOA_TABLE(Collisions, "AOD", "COLLISION", collision::VtxId, collision::P
 
 using Collision = Collisions::iterator;
 
+namespace collisiongroup
+{
+// Row aligned with COLLISION: first row and number of rows of the tracks
+// (TRACKPAR, TRACKPARCOV and TRACKEXTRA), calo cells and muons of each
+// collision, see o2::soa::GroupedTable.
+DECLARE_SOA_COLUMN(FirstTrack, firstTrack, int64_t, "fFirstTrack");
+DECLARE_SOA_COLUMN(NTracks, nTracks, int64_t, "fNTracks");
+DECLARE_SOA_COLUMN(FirstCalo, firstCalo, int64_t, "fFirstCalo");
+DECLARE_SOA_COLUMN(NCalos, nCalos, int64_t, "fNCalos");
+DECLARE_SOA_COLUMN(FirstMuon, firstMuon, int64_t, "fFirstMuon");
+DECLARE_SOA_COLUMN(NMuons, nMuons, int64_t, "fNMuons");
+} // namespace collisiongroup
+
+DECLARE_SOA_TABLE(CollisionGroups, "AOD", "COLLISIONGROUP",
+                  collisiongroup::FirstTrack, collisiongroup::NTracks,
+                  collisiongroup::FirstCalo, collisiongroup::NCalos,
+                  collisiongroup::FirstMuon, collisiongroup::NMuons);
+using CollisionGroup = CollisionGroups::iterator;
+
 namespace timeframe
 {
 DECLARE_SOA_COLUMN(Timestamp, timestamp, uint64_t, "timestamp");
@@ -252,5 +307,71 @@ using Timeframe = Timeframes::iterator;
 
 } // namespace aod
 
+namespace soa
+{
+// Single precision kernels used by materialize() for the track dynamic
+// columns. Eta relies on log(tan(pi/4 - atan(tgl)/2)) == -asinh(tgl), which
+// only needs one logarithm.
+template <>
+struct VectorizedCallback<aod::track::PhiCallback> {
+  constexpr static bool available = true;
+  using type = float;
+  static float compute(float snp, float alpha)
+  {
+    return framework::fastmath::asin(snp) + alpha + static_cast<float>(M_PI);
+  }
+};
+
+template <>
+struct VectorizedCallback<aod::track::EtaCallback> {
+  constexpr static bool available = true;
+  using type = float;
+  static float compute(float tgl)
+  {
+    return -framework::fastmath::asinh(tgl);
+  }
+};
+
+template <>
+struct VectorizedCallback<aod::track::PtCallback> {
+  constexpr static bool available = true;
+  using type = float;
+  static float compute(float signed1Pt)
+  {
+    return std::fabs(1.f / signed1Pt);
+  }
+};
+
+// Filter expressions for the same columns, following their lambdas with the
+// functions Gandiva has. Phi needs asin, which it has not, hence no filter
+// expression. Eta uses -asinh(tgl) == log(sqrt(1 + tgl^2) - tgl).
+template <>
+struct DynamicColumnExpression<aod::track::EtaCallback> {
+  constexpr static bool available = true;
+  static framework::expressions::Node compute(framework::expressions::Node tgl)
+  {
+    using namespace framework::expressions;
+    return nlog(nsqrt(1. + tgl * tgl) - tgl);
+  }
+};
+
+template <>
+struct DynamicColumnExpression<aod::track::PtCallback> {
+  constexpr static bool available = true;
+  static framework::expressions::Node compute(framework::expressions::Node signed1Pt)
+  {
+    return framework::expressions::nabs(1.f / std::move(signed1Pt));
+  }
+};
+} // namespace soa
+
+namespace aod::track
+{
+// Dynamic columns of Tracks as filter expressions, e.g.
+// soa::filter(tracks, aod::track::pt > 1.f && nabs(aod::track::eta) < 0.8f)
+static const framework::expressions::Node eta = soa::expression<Eta<Tgl>>();
+static const framework::expressions::Node pt = soa::expression<Pt<Signed1Pt>>();
+} // namespace aod::track
+
 } // namespace o2
 #endif // O2_FRAMEWORK_ANALYSISDATAMODEL_H_
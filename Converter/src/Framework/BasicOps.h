@@ -24,7 +24,12 @@ enum BasicOp : unsigned int {
   GreaterThan,
   GreaterThanOrEqual,
   Equal,
-  NotEqual
+  NotEqual,
+  Abs,
+  Sqrt,
+  Exp,
+  Log,
+  Log10
 };
 } // namespace o2::framework
 
@@ -18,9 +18,11 @@
 #include <gandiva/selection_vector.h>
 #include <gandiva/node.h>
 #include "gandiva/filter.h"
+#include <type_traits>
 #include <variant>
 #include <string>
 #include <memory>
+#include <vector>
 
 using atype = arrow::Type;
 
@@ -35,6 +37,11 @@ struct LiteralStorage {
 
 using LiteralValue = LiteralStorage<int, bool, float, double>;
 
+/// Restricts the operator overloads taking a literal to arithmetic types, so
+/// that operations between two nodes (or bindings) never end up there.
+template <typename T>
+using if_literal_t = std::enable_if_t<std::is_arithmetic_v<T>>;
+
 template <typename T>
 constexpr auto selectArrowType()
 {
@@ -67,6 +74,7 @@ struct LiteralNode {
 struct BindingNode {
   BindingNode(BindingNode const&) = default;
   BindingNode(BindingNode&&) = delete;
+  BindingNode& operator=(BindingNode const&) = default;
   BindingNode(std::string const& name_, atype::type type_) : name{name_}, type{type_} {}
   std::string name;
   atype::type type;
@@ -78,6 +86,12 @@ struct BinaryOpNode {
   BasicOp op;
 };
 
+/// An expression tree node corresponding to a function of one argument
+struct UnaryOpNode {
+  UnaryOpNode(BasicOp op_) : op{op_} {}
+  BasicOp op;
+};
+
 /// A generic tree node
 struct Node {
   Node(LiteralNode v) : self{v}, left{nullptr}, right{nullptr}
@@ -88,6 +102,24 @@ struct Node {
   {
   }
 
+  /// Deep copy, so that predefined expressions (e.g. those of the dynamic
+  /// columns) can be used in several filters.
+  Node(Node const& n)
+    : self{n.self},
+      left{n.left ? std::make_unique<Node>(*n.left) : nullptr},
+      right{n.right ? std::make_unique<Node>(*n.right) : nullptr}
+  {
+  }
+
+  /// Written out since BindingNode, hence self, cannot be moved.
+  Node& operator=(Node&& n)
+  {
+    self = n.self;
+    left = std::move(n.left);
+    right = std::move(n.right);
+    return *this;
+  }
+
   Node(BindingNode n) : self{n}, left{nullptr}, right{nullptr}
   {
   }
@@ -97,8 +129,13 @@ struct Node {
       left{std::make_unique<Node>(std::move(l))},
       right{std::make_unique<Node>(std::move(r))} {}
 
+  Node(UnaryOpNode op, Node&& l)
+    : self{op},
+      left{std::make_unique<Node>(std::move(l))},
+      right{nullptr} {}
+
   /// variant with possible nodes
-  using self_t = std::variant<LiteralNode, BindingNode, BinaryOpNode>;
+  using self_t = std::variant<LiteralNode, BindingNode, BinaryOpNode, UnaryOpNode>;
   self_t self;
   /// pointers to children
   std::unique_ptr<Node> left;
@@ -108,37 +145,37 @@ struct Node {
 /// overloaded operators to build the tree from an expression
 
 /// literal comparisons
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator>(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::GreaterThan}, std::move(left), LiteralNode{rightValue}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator<(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::LessThan}, std::move(left), LiteralNode{rightValue}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator>=(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::GreaterThanOrEqual}, std::move(left), LiteralNode{rightValue}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator<=(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::LessThanOrEqual}, std::move(left), LiteralNode{rightValue}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator==(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::Equal}, std::move(left), LiteralNode{rightValue}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator!=(Node left, T rightValue)
 {
   return Node{BinaryOpNode{BasicOp::NotEqual}, std::move(left), LiteralNode{rightValue}};
@@ -187,30 +224,106 @@ inline Node operator||(Node left, Node right)
 }
 
 /// arithmetical operations between node and literal
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator*(Node left, T right)
 {
   return Node{BinaryOpNode{BasicOp::Multiplication}, std::move(left), LiteralNode{right}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator/(Node left, T right)
 {
   return Node{BinaryOpNode{BasicOp::Division}, std::move(left), LiteralNode{right}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator+(Node left, T right)
 {
   return Node{BinaryOpNode{BasicOp::Addition}, std::move(left), LiteralNode{right}};
 }
 
-template <typename T>
+template <typename T, typename = if_literal_t<T>>
 inline Node operator-(Node left, T right)
 {
   return Node{BinaryOpNode{BasicOp::Subtraction}, std::move(left), LiteralNode{right}};
 }
 
+/// arithmetical operations between literal and node
+template <typename T, typename = if_literal_t<T>>
+inline Node operator*(T left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Multiplication}, LiteralNode{left}, std::move(right)};
+}
+
+template <typename T, typename = if_literal_t<T>>
+inline Node operator/(T left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Division}, LiteralNode{left}, std::move(right)};
+}
+
+template <typename T, typename = if_literal_t<T>>
+inline Node operator+(T left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Addition}, LiteralNode{left}, std::move(right)};
+}
+
+template <typename T, typename = if_literal_t<T>>
+inline Node operator-(T left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Subtraction}, LiteralNode{left}, std::move(right)};
+}
+
+/// arithmetical operations between nodes
+inline Node operator*(Node left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Multiplication}, std::move(left), std::move(right)};
+}
+
+inline Node operator/(Node left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Division}, std::move(left), std::move(right)};
+}
+
+inline Node operator+(Node left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Addition}, std::move(left), std::move(right)};
+}
+
+inline Node operator-(Node left, Node right)
+{
+  return Node{BinaryOpNode{BasicOp::Subtraction}, std::move(left), std::move(right)};
+}
+
+/// unary functions, prefixed with n to avoid clashing with those of <cmath>.
+/// All but nabs are evaluated in double precision. The Gandiva of Arrow 0.14
+/// and older has no abs, sqrt nor trigonometric functions: nabs and nsqrt
+/// are rewritten in terms of comparisons, exp and log, the trigonometric
+/// functions are not available.
+inline Node nabs(Node arg)
+{
+  return Node{UnaryOpNode{BasicOp::Abs}, std::move(arg)};
+}
+
+inline Node nsqrt(Node arg)
+{
+  return Node{UnaryOpNode{BasicOp::Sqrt}, std::move(arg)};
+}
+
+inline Node nexp(Node arg)
+{
+  return Node{UnaryOpNode{BasicOp::Exp}, std::move(arg)};
+}
+
+inline Node nlog(Node arg)
+{
+  return Node{UnaryOpNode{BasicOp::Log}, std::move(arg)};
+}
+
+inline Node nlog10(Node arg)
+{
+  return Node{UnaryOpNode{BasicOp::Log10}, std::move(arg)};
+}
+
 /// A struct, containing the root of the expression tree
 struct Filter {
   Filter(Node&& node_) : node{std::make_unique<Node>(std::move(node_))} {}
@@ -221,7 +334,18 @@ struct Filter {
 using Selection = std::shared_ptr<gandiva::SelectionVector>;
 Selection createSelection(std::shared_ptr<arrow::Table> table, Filter const& expression);
 
-struct ColumnOperationSpec;
+/// An operand of a ColumnOperationSpec: nothing, the result of a previous
+/// operation (by index), a literal or a column (by name).
+using DatumSpec = std::variant<std::monostate, size_t, LiteralNode::var_t, std::string>;
+
+/// A flattened node of the expression tree. Operations are stored so that
+/// operands always come before their users, the root being the last one.
+/// Unary operations leave right empty.
+struct ColumnOperationSpec {
+  BasicOp op;
+  DatumSpec left;
+  DatumSpec right;
+};
 using Operations = std::vector<ColumnOperationSpec>;
 
 Operations createOperations(Filter const& expression);
@@ -231,6 +355,23 @@ gandiva::NodePtr createExpressionTree(Operations const& opSpecs,
 std::shared_ptr<gandiva::Filter> createFilter(gandiva::SchemaPtr const& Schema,
                                               gandiva::ConditionPtr condition);
 
+/// Canonical textual form of @a opSpecs, used as part of the filter cache key.
+std::string canonicalForm(Operations const& opSpecs);
+
+/// Same as createFilter, but compiling (i.e. JITting) each combination of
+/// schema and expression only once per process.
+std::shared_ptr<gandiva::Filter> cachedFilter(gandiva::SchemaPtr const& Schema,
+                                              Operations const& opSpecs);
+
+/// Counters of the process wide filter cache.
+struct FilterCacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  /// Time spent building and compiling the filters which were not cached.
+  double jitSeconds = 0;
+};
+FilterCacheStats filterCacheStats();
+
 } // namespace o2::framework::expressions
 
 #endif // O2_FRAMEWORK_EXPRESSIONS_H_
@@ -0,0 +1,89 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Single precision approximations of a few transcendental functions, written
+// without branches nor calls to libm so that loops over whole arrays using
+// them get auto-vectorized. They are derived from the Cephes single precision
+// implementations and are only meant for finite arguments in the ranges
+// documented below.
+#ifndef O2_FRAMEWORK_FASTMATH_H_
+#define O2_FRAMEWORK_FASTMATH_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace o2::framework::fastmath
+{
+
+/// Natural logarithm for positive, normal @a x. The maximum relative error
+/// is below 3e-7 (about 2 ulp).
+inline float log(float x)
+{
+  int32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  // Split x into 2^e * m, with m in [0.5, 1).
+  int32_t e = ((bits >> 23) & 0xff) - 126;
+  bits = (bits & 0x807fffff) | 0x3f000000;
+  float m;
+  std::memcpy(&m, &bits, sizeof(m));
+  // Bring m in [sqrt(1/2), sqrt(2)) and take log(1 + (m - 1)).
+  bool const small = m < 0.707106781186547524f;
+  e -= small;
+  m = small ? m + m - 1.f : m - 1.f;
+  float const z = m * m;
+  float y = 7.0376836292e-2f;
+  y = y * m - 1.1514610310e-1f;
+  y = y * m + 1.1676998740e-1f;
+  y = y * m - 1.2420140846e-1f;
+  y = y * m + 1.4249322787e-1f;
+  y = y * m - 1.6668057665e-1f;
+  y = y * m + 2.0000714765e-1f;
+  y = y * m - 2.4999993993e-1f;
+  y = y * m + 3.3333331174e-1f;
+  y = y * m * z;
+  float const fe = e;
+  y += -2.12194440e-4f * fe;
+  y += -0.5f * z;
+  return m + y + 0.693359375f * fe;
+}
+
+/// Arc sine for @a x in [-1, 1]. The maximum absolute error is below 2e-7.
+inline float asin(float x)
+{
+  float const a = std::fabs(x);
+  bool const large = a > 0.5f;
+  float const z = large ? 0.5f * (1.f - a) : a * a;
+  float const r = large ? std::sqrt(z) : a;
+  float p = 4.2163199048e-2f;
+  p = p * z + 2.4181311049e-2f;
+  p = p * z + 4.5470025998e-2f;
+  p = p * z + 7.4953002686e-2f;
+  p = p * z + 1.6666752422e-1f;
+  float y = p * z * r + r;
+  y = large ? 1.57079632679489661923f - (y + y) : y;
+  return std::copysign(y, x);
+}
+
+/// Inverse hyperbolic sine, through log(|x| + sqrt(x^2 + 1)) or, for
+/// |x| < 0.125 where that would lose precision, through its Taylor series.
+/// The relative error is of the order of 1e-6.
+inline float asinh(float x)
+{
+  float const a = std::fabs(x);
+  float const a2 = a * a;
+  float const series = a * (1.f + a2 * (-1.f / 6.f + a2 * (3.f / 40.f)));
+  float const y = a < 0.125f ? series : log(a + std::sqrt(a2 + 1.f));
+  return std::copysign(y, x);
+}
+
+} // namespace o2::framework::fastmath
+
+#endif // O2_FRAMEWORK_FASTMATH_H_
@@ -12,6 +12,7 @@
 #define O2_FRAMEWORK_TABLEBUILDER_H_
 
 #include "Framework/ASoA.h"
+#include "Framework/CompilerBuiltins.h"
 #include "Framework/FunctionalHelpers.h"
 
 // Apparently needs to be on top of the arrow includes.
@@ -27,6 +28,7 @@
 #include <string>
 #include <memory>
 #include <tuple>
+#include <type_traits>
 
 namespace arrow
 {
@@ -279,15 +281,16 @@ class TableBuilder
   }
 
   /// Creates a lambda which is suitable to persist things
-  /// in an arrow::Table
+  /// in an arrow::Table. Space for @a nRows rows is reserved upfront,
+  /// builders grow as needed past that.
   template <typename... ARGS>
-  auto persist(std::vector<std::string> const& columnNames)
+  auto persist(std::vector<std::string> const& columnNames, size_t nRows = 1000)
   {
     using BuildersTuple = typename std::tuple<std::unique_ptr<typename BuilderTraits<ARGS>::BuilderType>...>;
     constexpr int nColumns = sizeof...(ARGS);
     validate<ARGS...>(columnNames);
     mArrays.resize(nColumns);
-    makeBuilders<ARGS...>(columnNames, 1000);
+    makeBuilders<ARGS...>(columnNames, nRows);
     makeFinalizer<ARGS...>();
 
     // Callback used to fill the builders
@@ -302,12 +305,36 @@ class TableBuilder
   // Same as above, but starting from a o2::soa::Table, which has all the
   // information already available.
   template <typename T>
-  auto cursor()
+  auto cursor(size_t nRows = 1000)
+  {
+    using persistent_filter = soa::FilterPersistentColumns<T>;
+    using persistent_columns_pack = typename persistent_filter::persistent_columns_pack;
+    constexpr auto persistent_size = pack_size(persistent_columns_pack{});
+    return cursorHelper<typename persistent_filter::persistent_table_t>(std::make_index_sequence<persistent_size>(), nRows);
+  }
+
+  /// Same as cursor(), but using the UnsafeAppend fast path of
+  /// preallocatedPersist. The caller must guarantee that no more than
+  /// @a nRows rows are ever filled.
+  template <typename T>
+  auto preallocatedCursor(size_t nRows)
+  {
+    using persistent_filter = soa::FilterPersistentColumns<T>;
+    using persistent_columns_pack = typename persistent_filter::persistent_columns_pack;
+    constexpr auto persistent_size = pack_size(persistent_columns_pack{});
+    return preallocatedCursorHelper<typename persistent_filter::persistent_table_t>(std::make_index_sequence<persistent_size>(), nRows);
+  }
+
+  /// Same as cursor(), but using bulkPersist, i.e. the returned lambda
+  /// appends a whole batch of rows at once, getting one pointer to
+  /// contiguous values per column.
+  template <typename T>
+  auto bulkCursor(size_t nRows)
   {
     using persistent_filter = soa::FilterPersistentColumns<T>;
     using persistent_columns_pack = typename persistent_filter::persistent_columns_pack;
     constexpr auto persistent_size = pack_size(persistent_columns_pack{});
-    return cursorHelper<typename persistent_filter::persistent_table_t>(std::make_index_sequence<persistent_size>());
+    return bulkCursorHelper<typename persistent_filter::persistent_table_t>(std::make_index_sequence<persistent_size>(), nRows);
   }
 
   template <typename... ARGS>
@@ -337,7 +364,10 @@ class TableBuilder
     makeFinalizer<ARGS...>();
 
     return [builders = (BuildersTuple*)mBuilders](unsigned int slot, size_t batchSize, typename BuilderMaker<ARGS>::FillType const*... args) -> void {
-      TableBuilderHelpers::bulkAppend(*builders, batchSize, std::index_sequence_for<ARGS...>{}, std::forward_as_tuple(args...));
+      auto status = TableBuilderHelpers::bulkAppend(*builders, batchSize, std::index_sequence_for<ARGS...>{}, std::forward_as_tuple(args...));
+      if (status == false) {
+        throw std::runtime_error("Unable to bulk append");
+      }
     };
   }
 
@@ -349,10 +379,24 @@ class TableBuilder
   /// template argument T is a o2::soa::Table which contains only the
   /// persistent columns.
   template <typename T, size_t... Is>
-  auto cursorHelper(std::index_sequence<Is...> s)
+  auto cursorHelper(std::index_sequence<Is...> s, size_t nRows)
   {
     std::vector<std::string> columnNames{pack_element_t<Is, typename T::columns>::label()...};
-    return this->template persist<typename pack_element_t<Is, typename T::columns>::type...>(columnNames);
+    return this->template persist<typename pack_element_t<Is, typename T::columns>::type...>(columnNames, nRows);
+  }
+
+  template <typename T, size_t... Is>
+  auto preallocatedCursorHelper(std::index_sequence<Is...> s, size_t nRows)
+  {
+    std::vector<std::string> columnNames{pack_element_t<Is, typename T::columns>::label()...};
+    return this->template preallocatedPersist<typename pack_element_t<Is, typename T::columns>::type...>(columnNames, nRows);
+  }
+
+  template <typename T, size_t... Is>
+  auto bulkCursorHelper(std::index_sequence<Is...> s, size_t nRows)
+  {
+    std::vector<std::string> columnNames{pack_element_t<Is, typename T::columns>::label()...};
+    return this->template bulkPersist<typename pack_element_t<Is, typename T::columns>::type...>(columnNames, nRows);
   }
 
   std::function<void(void)> mFinalizer;
@@ -362,6 +406,142 @@ class TableBuilder
   std::vector<std::shared_ptr<arrow::Array>> mArrays;
 };
 
+/// Same as TableBuilder::cursor<T>(), but without any type erasure: the
+/// builders of the persistent columns of the o2::soa::Table T are a member
+/// tuple of concrete types, so that fill() is a single inlined function.
+/// Space is reserved, and the status checked, once every batchSize rows,
+/// rows are then appended with UnsafeAppend. Only arithmetic columns are
+/// supported.
+template <typename T, typename COLUMNS = typename soa::FilterPersistentColumns<T>::persistent_columns_pack>
+class TypedTableBuilder;
+
+template <typename T, typename... C>
+class TypedTableBuilder<T, framework::pack<C...>>
+{
+  static_assert((std::is_arithmetic_v<typename C::type> && ...), "TypedTableBuilder only supports arithmetic columns");
+  using builders_t = std::tuple<typename BuilderTraits<typename C::type>::BuilderType...>;
+
+  template <typename>
+  static arrow::MemoryPool* poolFor(arrow::MemoryPool* pool)
+  {
+    return pool;
+  }
+
+ public:
+  TypedTableBuilder(int64_t batchSize = 1024, arrow::MemoryPool* pool = arrow::default_memory_pool())
+    : mBuilders{poolFor<C>(pool)...},
+      mBatchSize{batchSize}
+  {
+  }
+
+  /// Makes room for @a nRows more rows, e.g. when their number is known
+  /// upfront. Rows still free from an earlier reserve are kept, hence
+  /// Reserve() is asked for both, since it only counts from the length.
+  void reserve(int64_t nRows)
+  {
+    auto size = mFree + nRows;
+    auto ok = std::apply([size](auto&... builders) { return (builders.Reserve(size).ok() && ...); }, mBuilders);
+    if (ok == false) {
+      throw std::runtime_error("Unable to reserve rows");
+    }
+    mFree += nRows;
+  }
+
+  /// Appends a row.
+  void fill(typename C::type... values)
+  {
+    if (O2_BUILTIN_UNLIKELY(mFree == 0)) {
+      reserve(mBatchSize);
+    }
+    --mFree;
+    fillHelper(std::index_sequence_for<C...>{}, values...);
+  }
+
+  /// A lambda with the same signature as the one of TableBuilder::cursor(),
+  /// so that it can be used in its place.
+  auto cursor()
+  {
+    return [this](unsigned int, typename C::type... values) { fill(values...); };
+  }
+
+  /// Creates the arrow::Table from the builders
+  std::shared_ptr<arrow::Table> finalize()
+  {
+    std::vector<std::shared_ptr<arrow::Array>> arrays(sizeof...(C));
+    if (finishHelper(arrays, std::index_sequence_for<C...>{}) == false) {
+      throw std::runtime_error("Unable to finalize");
+    }
+    auto schema = std::make_shared<arrow::Schema>(TableBuilderHelpers::makeFields<typename C::type...>({C::label()...}));
+    return arrow::Table::Make(schema, arrays);
+  }
+
+ private:
+  template <size_t... Is>
+  void fillHelper(std::index_sequence<Is...>, typename C::type... values)
+  {
+    (std::get<Is>(mBuilders).UnsafeAppend(values), ...);
+  }
+
+  template <size_t... Is>
+  bool finishHelper(std::vector<std::shared_ptr<arrow::Array>>& arrays, std::index_sequence<Is...>)
+  {
+    return (std::get<Is>(mBuilders).Finish(&arrays[Is]).ok() && ...);
+  }
+
+  builders_t mBuilders;
+  int64_t mBatchSize;
+  /// Rows which can be appended before reserving more space.
+  int64_t mFree = 0;
+};
+
+/// Run length encoding of an integer column whose rows are grouped by value,
+/// typically the fCollisionsID of the tracks, calo cells or muons. Each run
+/// becomes a row (value, offset of the first row, number of rows) of an index
+/// table, so that the per row column can be dropped and all the rows of a
+/// given value can be sliced in O(1), see soa::CollisionRanges.
+class RunLengthIndexBuilder
+{
+ public:
+  /// Offsets start at @a firstRow, the row the first appended row has in the
+  /// table being indexed.
+  explicit RunLengthIndexBuilder(int64_t firstRow = 0) : mRows{firstRow} {}
+
+  /// Appends @a count rows holding @a value.
+  void append(int32_t value, int64_t count = 1)
+  {
+    if (count == 0) {
+      return;
+    }
+    if (mValues.empty() || mValues.back() != value) {
+      mValues.push_back(value);
+      mOffsets.push_back(mRows);
+      mCounts.push_back(0);
+    }
+    mCounts.back() += count;
+    mRows += count;
+  }
+
+  /// Appends all the rows of @a column, which must be an int32 one.
+  void append(arrow::Column const& column);
+
+  /// Creates the index table, whose three columns are the ones of the
+  /// o2::soa::Table @a T.
+  template <typename T>
+  std::shared_ptr<arrow::Table> finalize()
+  {
+    TableBuilder builder;
+    auto cursor = builder.bulkCursor<T>(mValues.size());
+    cursor(0, mValues.size(), mValues.data(), mOffsets.data(), mCounts.data());
+    return builder.finalize();
+  }
+
+ private:
+  std::vector<int32_t> mValues;
+  std::vector<int64_t> mOffsets;
+  std::vector<int64_t> mCounts;
+  int64_t mRows = 0;
+};
+
 } // namespace framework
 } // namespace o2
 #endif // FRAMEWORK_TABLEBUILDER_H
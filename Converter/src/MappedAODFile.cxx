@@ -0,0 +1,220 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "MappedAODFile.h"
+#include "AODCompression.h"
+
+#include <arrow/buffer.h>
+#include <arrow/io/file.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace o2::framework::run2 {
+
+namespace {
+/// Marks the end of a mapped AOD file. It is preceded by the number of index
+/// entries and by the size of the index itself, both as int64_t.
+constexpr char indexMagic[8] = {'A', 'O', 'D', 'I', 'N', 'D', 'X', '1'};
+constexpr int64_t trailerSize = 2 * sizeof(int64_t) + sizeof(indexMagic);
+constexpr int64_t initialCapacity = 64 << 20;
+
+std::string mappedPath(std::string const &target) {
+  static std::string const shmPrefix = "shm:";
+  if (target.compare(0, shmPrefix.size(), shmPrefix) == 0) {
+    return "/dev/shm/" + target.substr(target.find_first_not_of(
+                             '/', shmPrefix.size()));
+  }
+  return target;
+}
+
+template <typename T> void append(std::string &out, T const &value) {
+  out.append(reinterpret_cast<char const *>(&value), sizeof(T));
+}
+
+template <typename T>
+T extract(uint8_t const *data, int64_t &pos, int64_t end) {
+  if (pos + static_cast<int64_t>(sizeof(T)) > end) {
+    throw std::runtime_error("Truncated AOD index");
+  }
+  T value;
+  memcpy(&value, data + pos, sizeof(T));
+  pos += sizeof(T);
+  return value;
+}
+
+/// Whether the stream of @a entry lies within the first @a dataSize bytes.
+bool inBounds(AODIndexEntry const &entry, int64_t dataSize) {
+  return entry.offset >= 0 && entry.length >= 0 &&
+         entry.offset <= dataSize - entry.length;
+}
+} // namespace
+
+MappedAODOutputStream::MappedAODOutputStream(
+    std::shared_ptr<arrow::io::MemoryMappedFile> file, int64_t capacity)
+    : mFile{std::move(file)}, mCapacity{capacity} {}
+
+MappedAODOutputStream::~MappedAODOutputStream() {
+  if (mClosed == false) {
+    Close();
+  }
+}
+
+std::shared_ptr<MappedAODOutputStream>
+MappedAODOutputStream::open(std::string const &target) {
+  auto path = mappedPath(target);
+  std::shared_ptr<arrow::io::MemoryMappedFile> file;
+  auto status =
+      arrow::io::MemoryMappedFile::Create(path, initialCapacity, &file);
+  if (status.ok() == false) {
+    throw std::runtime_error("Unable to map " + path + ": " +
+                             status.ToString());
+  }
+  return std::shared_ptr<MappedAODOutputStream>(
+      new MappedAODOutputStream(file, initialCapacity));
+}
+
+arrow::Status MappedAODOutputStream::reserve(int64_t size) {
+  if (size <= mCapacity) {
+    return arrow::Status::OK();
+  }
+  auto capacity = std::max(2 * mCapacity, size);
+  ARROW_RETURN_NOT_OK(mFile->Resize(capacity));
+  mCapacity = capacity;
+  return arrow::Status::OK();
+}
+
+arrow::Status MappedAODOutputStream::Write(const void *data, int64_t nbytes) {
+  ARROW_RETURN_NOT_OK(reserve(mPosition + nbytes));
+  ARROW_RETURN_NOT_OK(mFile->Write(data, nbytes));
+  mPosition += nbytes;
+  return arrow::Status::OK();
+}
+
+arrow::Status MappedAODOutputStream::Tell(int64_t *position) const {
+  *position = mPosition;
+  return arrow::Status::OK();
+}
+
+arrow::Status MappedAODOutputStream::Flush() {
+  // Nothing is buffered, the data is already in the mapping.
+  return arrow::Status::OK();
+}
+
+bool MappedAODOutputStream::closed() const { return mClosed; }
+
+void MappedAODOutputStream::addIndexEntry(AODIndexEntry entry) {
+  mIndex.push_back(std::move(entry));
+}
+
+arrow::Status MappedAODOutputStream::Close() {
+  if (mClosed) {
+    return arrow::Status::OK();
+  }
+  mClosed = true;
+  // The index is built from what the writer reported rather than by reading
+  // the streams back: buffers exported from the mapping would prevent the
+  // final Resize().
+  std::string footer;
+  for (auto &entry : mIndex) {
+    append(footer, entry.offset);
+    append(footer, entry.length);
+    append(footer, entry.rows);
+    append(footer, entry.codec);
+    append(footer, static_cast<int32_t>(entry.description.size()));
+    footer += entry.description;
+  }
+  append(footer, static_cast<int64_t>(mIndex.size()));
+  append(footer, static_cast<int64_t>(footer.size() + sizeof(int64_t)));
+  footer.append(indexMagic, sizeof(indexMagic));
+  ARROW_RETURN_NOT_OK(Write(footer.data(), footer.size()));
+  ARROW_RETURN_NOT_OK(mFile->Resize(mPosition));
+  return mFile->Close();
+}
+
+std::shared_ptr<arrow::Buffer> mapAODFile(std::string const &source) {
+  auto path = mappedPath(source);
+  std::shared_ptr<arrow::io::MemoryMappedFile> file;
+  int64_t size;
+  std::shared_ptr<arrow::Buffer> data;
+  if (arrow::io::MemoryMappedFile::Open(path, arrow::io::FileMode::READ, &file)
+              .ok() == false ||
+      file->GetSize(&size).ok() == false ||
+      file->ReadAt(0, size, &data).ok() == false) {
+    throw std::runtime_error("Unable to map " + path);
+  }
+  return data;
+}
+
+std::vector<AODIndexEntry> readAODIndex(arrow::Buffer const &data) {
+  auto bytes = data.data();
+  int64_t size = data.size();
+  if (size < trailerSize ||
+      memcmp(bytes + size - sizeof(indexMagic), indexMagic,
+             sizeof(indexMagic)) != 0) {
+    throw std::runtime_error("Not an indexed AOD file");
+  }
+  int64_t pos = size - trailerSize + sizeof(int64_t);
+  auto indexSize = extract<int64_t>(bytes, pos, size);
+  int64_t end = size - sizeof(indexMagic) - sizeof(int64_t);
+  pos = size - sizeof(indexMagic) - indexSize;
+  if (pos < 0) {
+    throw std::runtime_error("Corrupted AOD index");
+  }
+  // The streams are all before the index.
+  int64_t dataSize = pos;
+  std::vector<AODIndexEntry> index;
+  int64_t indexEnd = end - sizeof(int64_t);
+  while (pos < indexEnd) {
+    AODIndexEntry entry;
+    entry.offset = extract<int64_t>(bytes, pos, indexEnd);
+    entry.length = extract<int64_t>(bytes, pos, indexEnd);
+    entry.rows = extract<int64_t>(bytes, pos, indexEnd);
+    entry.codec = extract<int32_t>(bytes, pos, indexEnd);
+    auto descriptionSize = extract<int32_t>(bytes, pos, indexEnd);
+    if (pos + descriptionSize > indexEnd) {
+      throw std::runtime_error("Truncated AOD index");
+    }
+    entry.description.assign(reinterpret_cast<char const *>(bytes + pos),
+                             descriptionSize);
+    pos += descriptionSize;
+    if (inBounds(entry, dataSize) == false) {
+      throw std::runtime_error("AOD index entry of " + entry.description +
+                               " out of the file");
+    }
+    index.push_back(entry);
+  }
+  auto entries = extract<int64_t>(bytes, pos, end);
+  if (entries != static_cast<int64_t>(index.size())) {
+    throw std::runtime_error("Corrupted AOD index");
+  }
+  return index;
+}
+
+std::shared_ptr<arrow::Buffer> tableStream(std::shared_ptr<arrow::Buffer> data,
+                                           AODIndexEntry const &entry) {
+  if (inBounds(entry, data->size()) == false) {
+    throw std::runtime_error("Stream of " + entry.description +
+                             " out of the file");
+  }
+  auto stream = arrow::SliceBuffer(data, entry.offset, entry.length);
+  if (entry.codec == arrow::Compression::UNCOMPRESSED) {
+    return stream;
+  }
+  auto header = readFrameHeader(stream->data(), stream->size());
+  if (header.frameSize() > stream->size()) {
+    throw std::runtime_error("Truncated compressed stream of " +
+                             entry.description);
+  }
+  return decompressFrame(header, stream->data() + compressedFrameHeaderSize);
+}
+
+} // namespace o2::framework::run2
@@ -0,0 +1,90 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_MappedAODFile_H_INCLUDED
+#define o2_framework_run2_MappedAODFile_H_INCLUDED
+
+#include <arrow/io/interfaces.h>
+#include <arrow/status.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace arrow {
+class Buffer;
+namespace io {
+class MemoryMappedFile;
+}
+} // namespace arrow
+
+namespace o2::framework::run2 {
+
+/// Where the Arrow stream of a table lives inside a mapped AOD file.
+struct AODIndexEntry {
+  std::string description;
+  int64_t offset = 0;
+  int64_t length = 0;
+  int64_t rows = 0;
+  /// Codec of the frame holding the stream, see AODCompression.h.
+  int32_t codec = 0;
+};
+
+/// Output stream writing the concatenated table streams produced by the
+/// converter straight into a memory mapped file, growing it as needed. The
+/// writer reports each stream with addIndexEntry() (see StreamTableSink). On
+/// Close() the index of the streams is appended as a footer and the file is
+/// truncated to its final size, so that consumers on the same node can map it
+/// and get at any table without copying or scanning.
+///
+/// Targets are either a path or shm:/name, the latter being a POSIX shared
+/// memory segment (i.e. /dev/shm/name).
+class MappedAODOutputStream : public arrow::io::OutputStream {
+public:
+  static std::shared_ptr<MappedAODOutputStream> open(std::string const &target);
+  ~MappedAODOutputStream() override;
+
+  arrow::Status Close() override;
+  arrow::Status Tell(int64_t *position) const override;
+  arrow::Status Write(const void *data, int64_t nbytes) override;
+  arrow::Status Flush() override;
+  bool closed() const override;
+
+  /// Records the stream of a table which was just written, for the index.
+  void addIndexEntry(AODIndexEntry entry);
+
+private:
+  explicit MappedAODOutputStream(
+      std::shared_ptr<arrow::io::MemoryMappedFile> file, int64_t capacity);
+  arrow::Status reserve(int64_t size);
+
+  std::shared_ptr<arrow::io::MemoryMappedFile> mFile;
+  int64_t mCapacity;
+  int64_t mPosition = 0;
+  std::vector<AODIndexEntry> mIndex;
+  bool mClosed = false;
+};
+
+/// Maps read only the AOD file written by MappedAODOutputStream to @a source,
+/// a path or shm:/name.
+std::shared_ptr<arrow::Buffer> mapAODFile(std::string const &source);
+
+/// Decodes the index footer of a mapped AOD file.
+std::vector<AODIndexEntry> readAODIndex(arrow::Buffer const &data);
+
+/// The Arrow stream of @a entry in the mapped file @a data. Uncompressed
+/// streams are returned as a slice of the mapping, compressed ones are
+/// decompressed.
+std::shared_ptr<arrow::Buffer> tableStream(std::shared_ptr<arrow::Buffer> data,
+                                           AODIndexEntry const &entry);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_MappedAODFile_H_INCLUDED
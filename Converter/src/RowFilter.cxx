@@ -0,0 +1,331 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "RowFilter.h"
+#include "Framework/AnalysisDataModel.h"
+#include "Framework/Expressions.h"
+
+#include <arrow/array.h>
+#include <arrow/buffer.h>
+#include <arrow/memory_pool.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace o2::framework::run2 {
+
+using namespace o2::framework::expressions;
+
+namespace {
+/// Recursive descent parser of the filter expressions, following the C++
+/// precedence of the operators.
+class FilterParser {
+public:
+  explicit FilterParser(std::string const &text) : mText{text} { next(); }
+
+  Node parse() {
+    auto node = parseOr();
+    if (mToken.empty() == false) {
+      fail("unexpected '" + mToken + "'");
+    }
+    return node;
+  }
+
+private:
+  [[noreturn]] void fail(std::string const &what) const {
+    throw std::runtime_error("Invalid filter \"" + mText + "\": " + what);
+  }
+
+  /// Moves to the next token, leaving mToken empty at the end of the text.
+  void next() {
+    while (mPos < mText.size() && std::isspace(mText[mPos])) {
+      ++mPos;
+    }
+    size_t const start = mPos;
+    if (mPos == mText.size()) {
+      mToken.clear();
+      return;
+    }
+    char const c = mText[mPos];
+    if (std::isdigit(c) || c == '.') {
+      while (mPos < mText.size() &&
+             (std::isalnum(mText[mPos]) || mText[mPos] == '.' ||
+              ((mText[mPos] == '+' || mText[mPos] == '-') &&
+               (mText[mPos - 1] == 'e' || mText[mPos - 1] == 'E')))) {
+        ++mPos;
+      }
+    } else if (std::isalpha(c) || c == '_') {
+      while (mPos < mText.size() &&
+             (std::isalnum(mText[mPos]) || mText[mPos] == '_')) {
+        ++mPos;
+      }
+    } else {
+      static char const *const twoChars[] = {"&&", "||", "<=", ">=", "==",
+                                             "!="};
+      mPos += 1;
+      for (auto op : twoChars) {
+        if (mText.compare(start, 2, op) == 0) {
+          mPos = start + 2;
+        }
+      }
+    }
+    mToken = mText.substr(start, mPos - start);
+  }
+
+  bool accept(char const *token) {
+    if (mToken == token) {
+      next();
+      return true;
+    }
+    return false;
+  }
+
+  Node parseOr() {
+    auto node = parseAnd();
+    while (accept("||")) {
+      node = std::move(node) || parseAnd();
+    }
+    return node;
+  }
+
+  Node parseAnd() {
+    auto node = parseComparison();
+    while (accept("&&")) {
+      node = std::move(node) && parseComparison();
+    }
+    return node;
+  }
+
+  Node parseComparison() {
+    auto node = parseSum();
+    if (accept("<")) {
+      return std::move(node) < parseSum();
+    } else if (accept("<=")) {
+      return std::move(node) <= parseSum();
+    } else if (accept(">")) {
+      return std::move(node) > parseSum();
+    } else if (accept(">=")) {
+      return std::move(node) >= parseSum();
+    } else if (accept("==")) {
+      return std::move(node) == parseSum();
+    } else if (accept("!=")) {
+      return std::move(node) != parseSum();
+    }
+    return node;
+  }
+
+  Node parseSum() {
+    auto node = parseProduct();
+    while (true) {
+      if (accept("+")) {
+        node = std::move(node) + parseProduct();
+      } else if (accept("-")) {
+        node = std::move(node) - parseProduct();
+      } else {
+        return node;
+      }
+    }
+  }
+
+  Node parseProduct() {
+    auto node = parseUnary();
+    while (true) {
+      if (accept("*")) {
+        node = std::move(node) * parseUnary();
+      } else if (accept("/")) {
+        node = std::move(node) / parseUnary();
+      } else {
+        return node;
+      }
+    }
+  }
+
+  Node parseUnary() {
+    if (accept("-")) {
+      return 0 - parseUnary();
+    }
+    if (accept("+")) {
+      return parseUnary();
+    }
+    return parsePrimary();
+  }
+
+  Node parsePrimary() {
+    if (mToken.empty()) {
+      fail("unexpected end");
+    }
+    if (accept("(")) {
+      auto node = parseOr();
+      if (accept(")") == false) {
+        fail("missing ')'");
+      }
+      return node;
+    }
+    auto const token = mToken;
+    if (std::isdigit(token[0]) || token[0] == '.') {
+      next();
+      return parseNumber(token);
+    }
+    if (std::isalpha(token[0]) == false && token[0] != '_') {
+      fail("unexpected '" + token + "'");
+    }
+    next();
+    if (accept("(")) {
+      auto arg = parseOr();
+      if (accept(")") == false) {
+        fail("missing ')' after the argument of " + token);
+      }
+      return applyFunction(token, std::move(arg));
+    }
+    if (token == "pt") {
+      return aod::track::pt;
+    } else if (token == "eta") {
+      return aod::track::eta;
+    } else if (token == "phi") {
+      fail("phi needs asin, which is not available in the Gandiva filters of "
+           "this Arrow version");
+    }
+    return BindingNode{token, atype::NA};
+  }
+
+  Node parseNumber(std::string const &token) {
+    size_t used = 0;
+    std::string digits = token;
+    if (digits.back() == 'f' || digits.back() == 'F') {
+      digits.pop_back();
+    }
+    try {
+      if (digits.find_first_of(".eE") == std::string::npos) {
+        int value = std::stoi(digits, &used);
+        if (used == digits.size()) {
+          return LiteralNode{value};
+        }
+      } else {
+        double value = std::stod(digits, &used);
+        if (used == digits.size()) {
+          return LiteralNode{value};
+        }
+      }
+    } catch (std::logic_error const &) {
+    }
+    fail("invalid number '" + token + "'");
+  }
+
+  Node applyFunction(std::string name, Node arg) {
+    if (name.size() > 1 && name[0] == 'n') {
+      name.erase(0, 1);
+    }
+    using Function = Node (*)(Node);
+    static std::map<std::string, Function> const functions{
+        {"abs", nabs}, {"sqrt", nsqrt}, {"exp", nexp}, {"log", nlog},
+        {"log10", nlog10}};
+    static std::set<std::string> const trigonometric{"sin",  "cos",  "tan",
+                                                     "asin", "acos", "atan"};
+    if (trigonometric.count(name)) {
+      fail(name +
+           " is not available in the Gandiva filters of this Arrow version");
+    }
+    auto it = functions.find(name);
+    if (it == functions.end()) {
+      fail("unknown function " + name);
+    }
+    return it->second(std::move(arg));
+  }
+
+  std::string mText;
+  size_t mPos = 0;
+  std::string mToken;
+};
+} // namespace
+
+std::shared_ptr<Filter const> parseFilter(std::string const &text) {
+  return std::make_shared<Filter const>(FilterParser{text}.parse());
+}
+
+bool usesOnlyColumnsOf(arrow::Table const &table, Filter const &filter) {
+  return isSchemaCompatible(table.schema(), createOperations(filter));
+}
+
+std::vector<int64_t> selectRows(std::shared_ptr<arrow::Table> const &table,
+                                Filter const &filter) {
+  auto selection = createSelection(table, filter);
+  std::vector<int64_t> rows(selection->GetNumSlots());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    rows[i] = selection->GetIndex(i);
+  }
+  return rows;
+}
+
+std::shared_ptr<arrow::Table>
+joinColumns(std::vector<std::shared_ptr<arrow::Table>> const &tables) {
+  std::vector<std::shared_ptr<arrow::Field>> fields;
+  std::vector<std::shared_ptr<arrow::Column>> columns;
+  std::set<std::string> names;
+  for (auto &table : tables) {
+    if (table->num_rows() != tables.front()->num_rows()) {
+      throw std::runtime_error("Cannot join tables with different rows");
+    }
+    for (int ci = 0; ci < table->num_columns(); ++ci) {
+      auto field = table->schema()->field(ci);
+      if (names.insert(field->name()).second) {
+        fields.push_back(field);
+        columns.push_back(table->column(ci));
+      }
+    }
+  }
+  return arrow::Table::Make(arrow::schema(fields), columns);
+}
+
+std::shared_ptr<arrow::Table> takeRows(arrow::Table const &table,
+                                       std::vector<int64_t> const &rows) {
+  std::vector<std::shared_ptr<arrow::Column>> columns;
+  for (int ci = 0; ci < table.num_columns(); ++ci) {
+    auto column = table.column(ci);
+    auto type =
+        std::dynamic_pointer_cast<arrow::FixedWidthType>(column->type());
+    if (type == nullptr || type->bit_width() % 8 != 0 ||
+        column->null_count() != 0) {
+      throw std::runtime_error("Cannot filter column " + column->name());
+    }
+    int64_t const width = type->bit_width() / 8;
+    std::shared_ptr<arrow::Buffer> buffer;
+    if (arrow::AllocateBuffer(arrow::default_memory_pool(),
+                              rows.size() * width, &buffer)
+            .ok() == false) {
+      throw std::runtime_error("Unable to allocate " + column->name());
+    }
+    auto out = buffer->mutable_data();
+    auto const &chunks = column->data()->chunks();
+    size_t chunk = 0;
+    int64_t chunkStart = 0;
+    for (auto row : rows) {
+      while (row >= chunkStart + chunks[chunk]->length()) {
+        chunkStart += chunks[chunk]->length();
+        ++chunk;
+      }
+      auto const &data = chunks[chunk]->data();
+      memcpy(out,
+             data->buffers[1]->data() + (data->offset + row - chunkStart) * width,
+             width);
+      out += width;
+    }
+    auto data = arrow::ArrayData::Make(column->type(), rows.size(),
+                                       {nullptr, buffer}, 0);
+    columns.push_back(std::make_shared<arrow::Column>(column->field(),
+                                                      arrow::MakeArray(data)));
+  }
+  return arrow::Table::Make(table.schema(), columns, rows.size());
+}
+
+} // namespace o2::framework::run2
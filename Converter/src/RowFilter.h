@@ -0,0 +1,62 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_RowFilter_H_INCLUDED
+#define o2_framework_run2_RowFilter_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace arrow {
+class Table;
+}
+
+namespace o2::framework::expressions {
+struct Filter;
+}
+
+namespace o2::framework::run2 {
+
+/// Parses a filter written as in C++ with the expressions of
+/// Framework/Expressions.h, e.g. `fTPCncls > 70 && pt > 0.15`:
+///
+/// - identifiers are column names, but for `pt` and `eta` which are the track
+///   dynamic columns (aod::track::pt, ...);
+/// - `abs`, `sqrt`, `exp`, `log` and `log10` (or the same with an n prefix)
+///   are functions. The Gandiva of Arrow 0.14 has no trigonometric functions,
+///   hence these and `phi` are rejected;
+/// - numbers with a decimal point or an exponent are doubles, others ints.
+///
+/// Throws std::runtime_error on syntax errors.
+std::shared_ptr<expressions::Filter const> parseFilter(std::string const &text);
+
+/// Whether all the columns used by @a filter are in @a table.
+bool usesOnlyColumnsOf(arrow::Table const &table,
+                       expressions::Filter const &filter);
+
+/// Ascending numbers of the rows of @a table selected by @a filter.
+std::vector<int64_t> selectRows(std::shared_ptr<arrow::Table> const &table,
+                                expressions::Filter const &filter);
+
+/// The columns of all @a tables, which must have the same number of rows, as
+/// a single table. Columns whose name is already taken are skipped.
+std::shared_ptr<arrow::Table>
+joinColumns(std::vector<std::shared_ptr<arrow::Table>> const &tables);
+
+/// Copy of @a table with only its @a rows (in ascending order). Only fixed
+/// width, byte aligned columns without nulls are supported, which covers all
+/// the AOD tables.
+std::shared_ptr<arrow::Table> takeRows(arrow::Table const &table,
+                                       std::vector<int64_t> const &rows);
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_RowFilter_H_INCLUDED
@@ -0,0 +1,96 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "Run2ESDTrackReader.h"
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeReader.h>
+#include <TTreeReaderArray.h>
+
+#include <stdexcept>
+
+namespace o2::framework::run2 {
+
+namespace {
+/// Copies the N values per track interleaved in @a source into one column per
+/// element of @a columns.
+template <size_t N>
+void deinterleave(TTreeReaderArray<Double32_t> &source, size_t nTracks,
+                  std::array<std::vector<float> *, N> const &columns) {
+  if (source.GetSize() != nTracks * N) {
+    throw std::runtime_error(std::string("Unexpected size for ") +
+                             source.GetBranchName());
+  }
+  for (size_t ci = 0; ci < N; ++ci) {
+    columns[ci]->resize(nTracks);
+  }
+  for (size_t ti = 0; ti < nTracks; ++ti) {
+    for (size_t ci = 0; ci < N; ++ci) {
+      (*columns[ci])[ti] = source[ti * N + ci];
+    }
+  }
+}
+} // namespace
+
+Run2ESDTrackReader::Run2ESDTrackReader(std::string const &filename,
+                                       std::string const &treename,
+                                       bool readParameters,
+                                       bool readCovariance)
+    : mFile{TFile::Open(filename.c_str())} {
+  if (!mFile || mFile->IsZombie()) {
+    throw std::runtime_error("Unable to open " + filename);
+  }
+  mTree = (TTree *)mFile->Get(treename.c_str());
+  if (mTree == nullptr) {
+    throw std::runtime_error("Unable to find " + treename + " in " + filename);
+  }
+  mReader = std::make_unique<TTreeReader>(mTree);
+  // fX is always read, as it also gives the number of tracks.
+  mX = std::make_unique<TTreeReaderArray<Double32_t>>(*mReader, "Tracks.fX");
+  if (readParameters) {
+    mAlpha = std::make_unique<TTreeReaderArray<Double32_t>>(*mReader,
+                                                            "Tracks.fAlpha");
+    mP = std::make_unique<TTreeReaderArray<Double32_t>>(*mReader, "Tracks.fP");
+  }
+  if (readCovariance) {
+    mC = std::make_unique<TTreeReaderArray<Double32_t>>(*mReader, "Tracks.fC");
+  }
+}
+
+Run2ESDTrackReader::~Run2ESDTrackReader() = default;
+
+size_t Run2ESDTrackReader::readEntry(Long64_t entry) {
+  if (mReader->SetEntry(entry) != TTreeReader::kEntryValid) {
+    throw std::runtime_error("Unable to read entry " + std::to_string(entry) +
+                             " of the ESD tracks");
+  }
+  size_t nTracks = mX->GetSize();
+  if (mP) {
+    mColumns.x.resize(nTracks);
+    mColumns.alpha.resize(nTracks);
+    for (size_t ti = 0; ti < nTracks; ++ti) {
+      mColumns.x[ti] = (*mX)[ti];
+      mColumns.alpha[ti] = (*mAlpha)[ti];
+    }
+    deinterleave<5>(*mP, nTracks,
+                    {&mColumns.y, &mColumns.z, &mColumns.snp, &mColumns.tgl,
+                     &mColumns.signed1Pt});
+  }
+  if (mC) {
+    std::array<std::vector<float> *, 15> cov;
+    for (size_t ci = 0; ci < cov.size(); ++ci) {
+      cov[ci] = &mColumns.cov[ci];
+    }
+    deinterleave<15>(*mC, nTracks, cov);
+  }
+  return nTracks;
+}
+
+} // namespace o2::framework::run2
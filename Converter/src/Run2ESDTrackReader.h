@@ -0,0 +1,76 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_Run2ESDTrackReader_H_INCLUDED
+#define o2_framework_run2_Run2ESDTrackReader_H_INCLUDED
+
+#include <Rtypes.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+class TFile;
+class TTree;
+class TTreeReader;
+template <typename T> class TTreeReaderArray;
+
+namespace o2::framework::run2 {
+
+/// Reads the track parameters and their covariance straight from the split
+/// Tracks.fX, Tracks.fAlpha, Tracks.fP[5] and Tracks.fC[15] leaves of an
+/// esdTree, without materialising any AliESDtrack. The values of the last
+/// entry read are available as contiguous float columns, ready to be bulk
+/// appended to the TRACKPAR / TRACKPARCOV builders.
+///
+/// The reader opens its own copy of the file, as a TTreeReader cannot share
+/// branches with the addresses set by AliESDEvent::ReadFromTree.
+class Run2ESDTrackReader {
+public:
+  /// Per column values of the tracks of the current entry. Storage is reused
+  /// from one entry to the next.
+  struct Columns {
+    std::vector<float> x;
+    std::vector<float> alpha;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> snp;
+    std::vector<float> tgl;
+    std::vector<float> signed1Pt;
+    /// Covariance matrix elements, in the AliExternalTrackParam::fC order.
+    std::array<std::vector<float>, 15> cov;
+  };
+
+  Run2ESDTrackReader(std::string const &filename, std::string const &treename,
+                     bool readParameters, bool readCovariance);
+  ~Run2ESDTrackReader();
+
+  /// The tree the values are read from.
+  TTree *tree() const { return mTree; }
+
+  /// Reads @a entry and returns the number of tracks in it.
+  size_t readEntry(Long64_t entry);
+
+  Columns const &columns() const { return mColumns; }
+
+private:
+  std::unique_ptr<TFile> mFile;
+  TTree *mTree = nullptr;
+  std::unique_ptr<TTreeReader> mReader;
+  std::unique_ptr<TTreeReaderArray<Double32_t>> mX;
+  std::unique_ptr<TTreeReaderArray<Double32_t>> mAlpha;
+  std::unique_ptr<TTreeReaderArray<Double32_t>> mP;
+  std::unique_ptr<TTreeReaderArray<Double32_t>> mC;
+  Columns mColumns;
+};
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_Run2ESDTrackReader_H_INCLUDED
@@ -8,6 +8,11 @@
 // granted to it by virtue of its status as an Intergovernmental Organization
 // or submit itself to any jurisdiction.
 #include "Run3AODConverter.h"
+#include "ArenaMemoryPool.h"
+#include "ColumnPrecision.h"
+#include "Run2ESDTrackReader.h"
+#include "RowFilter.h"
+#include "TableSink.h"
 #include "Framework/AnalysisDataModel.h"
 #include "Framework/TableBuilder.h"
 
@@ -19,91 +24,845 @@
 #include "AliESDtrack.h"
 #include "AliExternalTrackParam.h"
 
+#include <TBranch.h>
+#include <TFile.h>
+#include <TROOT.h>
 #include <TTree.h>
+#include <TTreeCache.h>
+#include <TTreeFormula.h>
 
 #include <arrow/io/buffered.h>
 #include <arrow/io/file.h>
 #include <arrow/ipc/writer.h>
+#include <arrow/memory_pool.h>
 #include <arrow/util/io-util.h>
 #include <arrow/util/key_value_metadata.h>
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 template class std::shared_ptr<arrow::Table>;
 
 namespace o2::framework::run2 {
 
+namespace {
+/// Position of each table in a ConvertedRange. The order is the one in which
+/// tables are written to the output.
+enum AODTableId : size_t {
+  kTracks,
+  kTracksCov,
+  kTracksExtra,
+  kCalos,
+  kMuons,
+  kVZeros,
+  kCollisions,
+  kNAODTables
+};
+
+/// Descriptions of the tables above, as used by --tables.
+std::array<char const *, kNAODTables> const aodTableNames{
+    aod::TracksMetadata::mDescription,   aod::TracksCovMetadata::mDescription,
+    aod::TracksExtraMetadata::mDescription, aod::CalosMetadata::mDescription,
+    aod::MuonsMetadata::mDescription,    aod::VZerosMetadata::mDescription,
+    aod::CollisionsMetadata::mDescription};
+
+/// ESD branches which need to be read to fill each of the tables above.
+std::array<std::vector<std::string>, kNAODTables> const esdBranchesForTable{{
+    {"Tracks"},
+    {"Tracks"},
+    {"Tracks"},
+    {"EMCALCells", "PHOSCells"},
+    {"MuonTracks"},
+    {"AliESDVZERO"},
+    // The number of tracks is stored in the collision, hence Tracks, unless
+    // it comes from the Run2ESDTrackReader.
+    {"SPDVertex", "Tracks"},
+}};
+
+/// ESD branches which are always read, as they are small and describe the
+/// whole event.
+std::vector<std::string> const esdAlwaysReadBranches{"AliESDRun",
+                                                     "AliESDHeader"};
+
+/// Which of the tables above should be filled.
+using TableSelection = std::array<bool, kNAODTables>;
+
+TableSelection selectTables(std::set<std::string> const &requested) {
+  TableSelection enabled;
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    enabled[ti] = requested.empty() || requested.count(aodTableNames[ti]);
+  }
+  return enabled;
+}
+
+/// How each of the tables is going to be filled.
+struct ConversionPlan {
+  /// Tables filled out of the AliESDEvent objects.
+  TableSelection object{};
+  /// Tables filled by the Run2ESDTrackReader, bypassing the ESD objects.
+  TableSelection direct{};
+  /// Tables which are filled both ways, to check that the direct reading is
+  /// bit by bit identical to the object one.
+  TableSelection verify{};
+  /// Precision the float columns are reduced to, empty to keep them as they
+  /// are.
+  std::vector<ColumnPrecision> precisions;
+  /// Selection applied to the tracks, calo cells or muons, whichever have
+  /// all the columns it uses. Null to keep all the rows.
+  std::shared_ptr<expressions::Filter const> filter;
+  /// Fill the track tables one row at a time rather than through the per
+  /// event StagedTracks.
+  bool rowWiseTracks = false;
+  /// Pools the builders of each table allocate from.
+  std::array<arrow::MemoryPool *, kNAODTables> pools{};
+  /// Collision id of entry 0, see Offsets::collisions.
+  size_t collisionOffset = 0;
+
+  bool needsTrackReader() const {
+    return std::find(direct.begin(), direct.end(), true) != direct.end();
+  }
+};
+
+/// One arena pool per table, so that allocations can be reported per table.
+/// They are never destroyed, as the tables they allocated may be kept by the
+/// caller after the conversion.
+std::array<ArenaMemoryPool, kNAODTables> &arenaPools() {
+  static auto pools = new std::array<ArenaMemoryPool, kNAODTables>;
+  return *pools;
+}
+
+/// The top level ESD branches needed to fill the tables of @a plan through
+/// the ESD objects.
+std::set<std::string> esdBranches(ConversionPlan const &plan) {
+  std::set<std::string> branches(esdAlwaysReadBranches.begin(),
+                                 esdAlwaysReadBranches.end());
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    if (plan.object[ti] == false) {
+      continue;
+    }
+    for (auto &branch : esdBranchesForTable[ti]) {
+      if (ti == kCollisions && branch == "Tracks" && plan.needsTrackReader()) {
+        continue;
+      }
+      branches.insert(branch);
+    }
+  }
+  return branches;
+}
+
+/// Switches off all the ESD branches which are not needed to fill the
+/// tables of @a plan through the ESD objects, so that they are neither
+/// decompressed nor streamed.
+void selectBranches(TTree *tEsd, ConversionPlan const &plan) {
+  tEsd->SetBranchStatus("*", 0);
+  for (auto &branch : esdBranches(plan)) {
+    // Branches can be called either "Name" or "Name." and split ones have
+    // sub-branches, hence the wildcard.
+    if (tEsd->GetBranch(branch.c_str()) ||
+        tEsd->GetBranch((branch + ".").c_str())) {
+      tEsd->SetBranchStatus((branch + "*").c_str(), 1);
+    }
+  }
+}
+
+/// Calls @a f for every branch holding baskets at or below @a branch: the
+/// leaves, but also the split master branches (e.g. Tracks) which keep the
+/// number of elements of each entry in their own baskets. Disabled branches
+/// are skipped when @a enabledOnly is set.
+template <typename F>
+void forEachBasketBranch(TBranch *branch, bool enabledOnly, F &&f) {
+  bool const leaf = branch->GetListOfBranches()->GetEntriesFast() == 0;
+  if ((leaf || branch->GetZipBytes() > 0) &&
+      (enabledOnly == false || branch->TestBit(kDoNotProcess) == false)) {
+    f(branch);
+  }
+  TIter next(branch->GetListOfBranches());
+  while (auto sub = static_cast<TBranch *>(next())) {
+    forEachBasketBranch(sub, enabledOnly, f);
+  }
+}
+
+/// Sizes the TTreeCache so that it can hold two clusters of the enabled
+/// branches: the one being converted and the one being prefetched.
+Long64_t estimateCacheSize(TTree *tEsd, Long64_t first) {
+  constexpr Long64_t minCacheSize = 1 << 20;
+  if (tEsd->GetEntries() == 0) {
+    return minCacheSize;
+  }
+  Long64_t zipBytes = 0;
+  TIter next(tEsd->GetListOfBranches());
+  while (auto branch = static_cast<TBranch *>(next())) {
+    forEachBasketBranch(branch, true, [&zipBytes](TBranch *baskets) {
+      zipBytes += baskets->GetZipBytes();
+    });
+  }
+  auto clusters = tEsd->GetClusterIterator(first);
+  Long64_t clusterStart = clusters();
+  Long64_t clusterEntries = clusters.GetNextEntry() - clusterStart;
+  return std::max(minCacheSize,
+                  2 * zipBytes * clusterEntries / tEsd->GetEntries());
+}
+
+/// Sets up the TTreeCache of @a tEsd for reading the entries [first, last).
+/// Must be called once the branch status is final, as only the enabled
+/// branches are cached and the learning phase is skipped altogether. Basket
+/// decompression is moved to the implicit MT pool when requested.
+void setupTreeCache(TTree *tEsd, Run3AODConverter::Options const &options,
+                    Long64_t first, Long64_t last) {
+  Long64_t cacheSize = options.cacheSize > 0 ? options.cacheSize
+                                             : estimateCacheSize(tEsd, first);
+  // A cache of the same size was already set up, and possibly filled, by
+  // Run3AODConverter::prepare(). Any other one (e.g. the default one created
+  // with the file) is dropped, so that the new one gets the unzipping flavour
+  // when needed.
+  if (tEsd->GetCacheSize() != cacheSize) {
+    tEsd->SetCacheSize(0);
+    tEsd->SetParallelUnzip(options.unzipThreads > 0);
+    tEsd->SetCacheSize(cacheSize);
+  }
+  tEsd->SetCacheEntryRange(first, last);
+  tEsd->SetClusterPrefetch(true);
+  TIter next(tEsd->GetListOfBranches());
+  while (auto branch = static_cast<TBranch *>(next())) {
+    forEachBasketBranch(branch, true, [tEsd](TBranch *baskets) {
+      tEsd->AddBranchToCache(baskets, false);
+    });
+  }
+  tEsd->StopCacheLearningPhase();
+}
+
+/// Compressed bytes of the ESD branches read by a conversion: those of the
+/// baskets which have to be fetched to read a range of entries, and the share
+/// of them which actually belongs to the entries in the range.
+struct BranchIO {
+  double read = 0;
+  double used = 0;
+};
+
+std::map<std::string, BranchIO>
+branchIO(TTree *tEsd, std::set<std::string> const &branches, Long64_t first,
+         Long64_t last) {
+  std::map<std::string, BranchIO> result;
+  TIter next(tEsd->GetListOfBranches());
+  while (auto branch = static_cast<TBranch *>(next())) {
+    std::string name = branch->GetName();
+    if (name.empty() == false && name.back() == '.') {
+      name.pop_back();
+    }
+    if (branches.count(name) == 0) {
+      continue;
+    }
+    BranchIO io;
+    forEachBasketBranch(branch, false, [&](TBranch *baskets) {
+      Int_t nBaskets = baskets->GetWriteBasket();
+      Long64_t *basketEntry = baskets->GetBasketEntry();
+      Int_t *basketBytes = baskets->GetBasketBytes();
+      for (Int_t ib = 0; ib < nBaskets; ++ib) {
+        Long64_t begin = basketEntry[ib];
+        Long64_t end =
+            ib + 1 < nBaskets ? basketEntry[ib + 1] : baskets->GetEntries();
+        Long64_t overlap = std::min(end, last) - std::max(begin, first);
+        if (overlap <= 0) {
+          continue;
+        }
+        io.read += basketBytes[ib];
+        io.used += double(basketBytes[ib]) * overlap / (end - begin);
+      }
+    });
+    if (io.read > 0) {
+      result[branch->GetName()] = io;
+    }
+  }
+  return result;
+}
+
+/// What was actually read from the input files during the conversion.
+struct FileIO {
+  Long64_t bytesRead = 0;
+  Int_t readCalls = 0;
+
+  void add(TFile *file, Long64_t bytesBefore, Int_t callsBefore) {
+    bytesRead += file->GetBytesRead() - bytesBefore;
+    readCalls += file->GetReadCalls() - callsBefore;
+  }
+};
+
+/// Prints, for each of the ESD branches read by @a plan, the compressed bytes
+/// fetched and used to convert [first, last), together with what was
+/// actually read from the files.
+void printIOReport(TTree *tEsd, ConversionPlan const &plan, Long64_t first,
+                   Long64_t last, FileIO const &fileIO) {
+  constexpr double MB = 1 << 20;
+  std::cerr << "I/O report for entries [" << first << ", " << last
+            << ") of " << tEsd->GetName() << "\n";
+  std::cerr << std::setw(20) << "branch" << std::setw(12) << "read (MB)"
+            << std::setw(12) << "used (MB)" << "\n";
+  BranchIO total;
+  for (auto &[name, io] : branchIO(tEsd, esdBranches(plan), first, last)) {
+    std::cerr << std::setw(20) << name << std::setw(12) << io.read / MB
+              << std::setw(12) << io.used / MB << "\n";
+    total.read += io.read;
+    total.used += io.used;
+  }
+  std::cerr << std::setw(20) << "total" << std::setw(12) << total.read / MB
+            << std::setw(12) << total.used / MB << "\n";
+  std::cerr << "Read from file: " << fileIO.bytesRead / MB << " MB in "
+            << fileIO.readCalls << " calls" << std::endl;
+}
+
+/// The tables resulting from the conversion of a contiguous range of ESD
+/// entries, together with the counters which decide which of them end up in
+/// the output.
+struct ConvertedRange {
+  std::array<std::shared_ptr<arrow::Table>, kNAODTables> tables;
+  size_t ntrk = 0;
+  size_t nmu = 0;
+  size_t ncalo = 0;
+  size_t nvzero = 0;
+  /// TRACKPAR, CALO and MUON rows of each converted entry, i.e. of each
+  /// COLLISION row.
+  std::vector<std::array<int64_t, 3>> rowsPerEntry;
+};
+
 template <typename T>
-void appendTable(std::vector<std::shared_ptr<arrow::Table>> &tables,
-                 TableBuilder &builder) {
+std::shared_ptr<arrow::Table>
+describeTable(std::shared_ptr<arrow::Table> const &table) {
   using metadata = typename aod::MetadataTrait<std::decay_t<T>>::metadata;
   auto metadataKeys = std::vector<std::string>{"description"};
   auto metadataValues = std::vector<std::string>{metadata::description()};
   auto schemaMetadata =
       std::make_shared<arrow::KeyValueMetadata>(metadataKeys, metadataValues);
-  tables.emplace_back(
-      builder.finalize()->ReplaceSchemaMetadata(schemaMetadata));
+  return table->ReplaceSchemaMetadata(schemaMetadata);
 }
 
-void Run3AODConverter::convert(TTree *tEsd,
-                               std::shared_ptr<arrow::io::OutputStream> stream,
-                               size_t nEvents) {
-  TableBuilder trackParBuilder;
-  TableBuilder trackParCovBuilder;
-  TableBuilder trackExtraBuilder;
-  TableBuilder caloBuilder;
-  TableBuilder muonBuilder;
-  TableBuilder v0Builder;
-  TableBuilder collisionsBuilder;
-  TableBuilder timeframeBuilder;
+template <typename T>
+std::shared_ptr<arrow::Table> makeTable(TableBuilder &builder) {
+  return describeTable<T>(builder.finalize());
+}
 
-  auto trackFiller = trackParBuilder.cursor<aod::Tracks>();
-  auto sigmaFiller = trackParCovBuilder.cursor<aod::TracksCov>();
-  auto extraFiller = trackExtraBuilder.cursor<aod::TracksExtra>();
-  auto caloFiller = caloBuilder.cursor<aod::Calos>();
-  auto muonFiller = muonBuilder.cursor<aod::Muons>();
-  auto vzeroFiller = v0Builder.cursor<aod::VZeros>();
-  auto collisionFiller = collisionsBuilder.cursor<aod::Collisions>();
-  auto timeframeFiller = timeframeBuilder.cursor<aod::Timeframes>();
+/// The COLLISIONGROUP table, with the first row and number of rows of the
+/// tracks, calo cells and muons of each collision in @a rowsPerEntry, rows
+/// starting at @a offsets.
+std::shared_ptr<arrow::Table> makeCollisionGroups(
+    std::vector<std::array<int64_t, 3>> const &rowsPerEntry,
+    Run3AODConverter::Offsets const &offsets) {
+  TableBuilder builder;
+  auto groupFiller =
+      builder.preallocatedCursor<aod::CollisionGroups>(rowsPerEntry.size());
+  std::array<int64_t, 3> first{offsets.tracks, offsets.calos, offsets.muons};
+  for (auto const &rows : rowsPerEntry) {
+    groupFiller(0, first[0], rows[0], first[1], rows[1], first[2], rows[2]);
+    for (size_t i = 0; i < first.size(); ++i) {
+      first[i] += rows[i];
+    }
+  }
+  return makeTable<aod::CollisionGroups>(builder);
+}
+
+/// Replaces the fCollisionsID column of @a table with the RANGES index table
+/// of the rows of each collision, appending both to @a out. The first row of
+/// @a table is row @a firstRow of the output.
+template <typename RANGES>
+void appendWithCollisionRanges(
+    std::vector<std::shared_ptr<arrow::Table>> &out,
+    std::shared_ptr<arrow::Table> const &table, int64_t firstRow) {
+  auto ci = table->schema()->GetFieldIndex("fCollisionsID");
+  RunLengthIndexBuilder ranges{firstRow};
+  ranges.append(*table->column(ci));
+  std::shared_ptr<arrow::Table> stripped;
+  if (table->RemoveColumn(ci, &stripped).ok() == false) {
+    throw std::runtime_error("Unable to remove fCollisionsID");
+  }
+  out.push_back(stripped);
+  out.push_back(describeTable<RANGES>(ranges.finalize<RANGES>()));
+}
+
+/// Appends table @a ti of @a range to the tables to be written, replacing the
+/// per row collision index of the tracks, calo cells and muons by collision
+/// ranges, starting at @a offsets, if requested.
+void appendOutputTable(std::vector<std::shared_ptr<arrow::Table>> &out,
+                       ConvertedRange const &range, size_t ti,
+                       Run3AODConverter::Options const &options,
+                       Run3AODConverter::Offsets const &offsets) {
+  auto const &table = range.tables[ti];
+  if (options.collisionRanges == false) {
+    out.push_back(table);
+  } else if (ti == kTracks) {
+    appendWithCollisionRanges<aod::TrackRanges>(out, table, offsets.tracks);
+  } else if (ti == kCalos) {
+    appendWithCollisionRanges<aod::CaloRanges>(out, table, offsets.calos);
+  } else if (ti == kMuons) {
+    appendWithCollisionRanges<aod::MuonRanges>(out, table, offsets.muons);
+  } else {
+    out.push_back(table);
+  }
+}
+
+/// Moves @a offsets past the tracks, calo cells and muons of @a range.
+void advanceOffsets(Run3AODConverter::Offsets &offsets,
+                    ConvertedRange const &range) {
+  int64_t tracks = 0;
+  for (auto ti : {kTracks, kTracksCov, kTracksExtra}) {
+    tracks = std::max(tracks, range.tables[ti]->num_rows());
+  }
+  offsets.tracks += tracks;
+  offsets.calos += range.tables[kCalos]->num_rows();
+  offsets.muons += range.tables[kMuons]->num_rows();
+}
 
-  AliESDEvent *esd = new AliESDEvent();
-  esd->ReadFromTree(tEsd);
+/// Number of rows the per entry tables get for a range of ESD entries.
+struct RowCounts {
+  size_t tracks = 0;
+  size_t calos = 0;
+  size_t muons = 0;
+};
+
+/// Detaches the TTreeCache of a tree for its lifetime, so that the baskets
+/// read meanwhile go straight to the file instead of filling the cache.
+class DetachedTreeCache {
+public:
+  explicit DetachedTreeCache(TTree *tree)
+      : mTree{tree}, mFile{tree->GetCurrentFile()},
+        mCache{mFile ? mFile->GetCacheRead(tree) : nullptr} {
+    if (mCache) {
+      mFile->SetCacheRead(nullptr, mTree, TFile::kDoNotDisconnect);
+    }
+  }
+  ~DetachedTreeCache() {
+    if (mCache) {
+      mFile->SetCacheRead(mCache, mTree, TFile::kDoNotDisconnect);
+    }
+  }
+  DetachedTreeCache(DetachedTreeCache const &) = delete;
+  DetachedTreeCache &operator=(DetachedTreeCache const &) = delete;
+
+private:
+  TTree *mTree;
+  TFile *mFile;
+  TFileCacheRead *mCache;
+};
+
+/// Sums @a expression over the entries [first, last) of @a tEsd. This is
+/// meant to be used on size leaves only, so that the baskets holding the
+/// actual content are not read. The cache is bypassed, otherwise the clusters
+/// of all the cached branches would be fetched (and possibly unzipped) once
+/// for the count and once more by the conversion itself.
+size_t sumOverEntries(TTree *tEsd, char const *expression, size_t first,
+                      size_t last) {
+  DetachedTreeCache detached(tEsd);
+  TTreeFormula formula("rowCount", expression, tEsd);
+  if (formula.GetNdim() == 0) {
+    return 0;
+  }
+  size_t total = 0;
+  for (size_t iev = first; iev < last; ++iev) {
+    tEsd->LoadTree(iev);
+    formula.GetNdata();
+    total += formula.EvalInstance64();
+  }
+  return total;
+}
+
+/// Pre-pass which computes the exact size of the track, calo and muon tables
+/// out of the size leaves, so that each builder is allocated only once.
+RowCounts countRows(TTree *tEsd, TableSelection const &enabled, size_t first,
+                    size_t last) {
+  RowCounts counts;
+  if ((enabled[kTracks] || enabled[kTracksCov] || enabled[kTracksExtra]) &&
+      tEsd->GetBranch("Tracks")) {
+    counts.tracks = sumOverEntries(tEsd, "@Tracks.size()", first, last);
+  }
+  if (enabled[kMuons] && tEsd->GetBranch("MuonTracks")) {
+    counts.muons = sumOverEntries(tEsd, "@MuonTracks.size()", first, last);
+  }
+  for (auto cells : {"EMCALCells", "PHOSCells"}) {
+    if (enabled[kCalos] == false) {
+      break;
+    }
+    if (tEsd->GetBranch(cells) ||
+        tEsd->GetBranch((std::string(cells) + ".").c_str())) {
+      counts.calos += sumOverEntries(
+          tEsd, (std::string(cells) + ".fNCells").c_str(), first, last);
+    }
+  }
+  return counts;
+}
+
+/// Validates the table descriptions in @a options and returns the tables to be
+/// produced.
+TableSelection enabledTables(Run3AODConverter::Options const &options) {
+  for (auto &name : options.tables) {
+    if (name != aod::TimeframesMetadata::mDescription &&
+        std::find(aodTableNames.begin(), aodTableNames.end(), name) ==
+            aodTableNames.end()) {
+      throw std::runtime_error("Unknown AOD table " + name);
+    }
+  }
+  return selectTables(options.tables);
+}
+
+/// Number of entries of @a tEsd to be converted.
+size_t entriesToConvert(TTree *tEsd,
+                        Run3AODConverter::Options const &options) {
   size_t nev = tEsd->GetEntries();
-  if ((nEvents > 0) && (nEvents < nev)) {
-    nev = nEvents;
+  if ((options.nEvents > 0) && (options.nEvents < nev)) {
+    nev = options.nEvents;
   }
-  size_t ntrk = 0;
-  size_t nmu = 0;
-  size_t ncalo = 0;
-  size_t nvzero = 0;
-  // FIXME: what should we put as a timestamp for the timeframe??
-  timeframeFiller(0, 0);
+  return nev;
+}
+
+/// Decides which of the @a enabled tables are read directly from the ESD
+/// leaves and which ones go through the AliESDEvent objects.
+ConversionPlan planConversion(Run3AODConverter::Options const &options,
+                              TableSelection const &enabled) {
+  ConversionPlan plan;
+  for (auto &name : options.directRead) {
+    auto it = std::find(aodTableNames.begin(), aodTableNames.end(), name);
+    size_t ti = it - aodTableNames.begin();
+    if (ti != kTracks && ti != kTracksCov) {
+      throw std::runtime_error("Direct reading is not supported for " + name);
+    }
+    plan.direct[ti] = enabled[ti];
+  }
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    plan.verify[ti] = plan.direct[ti] && options.verifyDirectRead;
+    plan.object[ti] = enabled[ti] && (!plan.direct[ti] || plan.verify[ti]);
+  }
+  // Direct reading only pays off if no AliESDtrack is streamed at all.
+  if (plan.needsTrackReader() && options.verifyDirectRead == false) {
+    for (auto ti : {kTracks, kTracksCov, kTracksExtra}) {
+      if (plan.object[ti]) {
+        throw std::runtime_error(
+            std::string("Direct reading of the tracks requires ") +
+            aodTableNames[ti] +
+            " to be read directly as well, or not to be produced (see "
+            "--tables), as it is filled from the AliESDtrack objects");
+      }
+    }
+  }
+  plan.rowWiseTracks = options.rowWiseTracks;
+  plan.collisionOffset = options.offsets.collisions;
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    plan.pools[ti] = options.arenaMemoryPool ? &arenaPools()[ti]
+                                             : arrow::default_memory_pool();
+  }
+  return plan;
+}
 
-  for (size_t iev = 0; iev < nev; ++iev) {
+/// Checks that @a a and @a b hold exactly the same bits. Unlike
+/// arrow::Table::Equals this also considers matching NaNs as identical.
+bool identicalTables(arrow::Table const &a, arrow::Table const &b) {
+  if (a.num_columns() != b.num_columns() || a.num_rows() != b.num_rows()) {
+    return false;
+  }
+  for (int ci = 0; ci < a.num_columns(); ++ci) {
+    auto chunksA = a.column(ci)->data();
+    auto chunksB = b.column(ci)->data();
+    if (chunksA->num_chunks() != 1 || chunksB->num_chunks() != 1) {
+      return false;
+    }
+    auto arrayA = chunksA->chunk(0)->data();
+    auto arrayB = chunksB->chunk(0)->data();
+    if (arrayA->type->Equals(arrayB->type) == false) {
+      return false;
+    }
+    if (arrayA->length == 0) {
+      continue;
+    }
+    auto byteWidth =
+        static_cast<arrow::FixedWidthType const &>(*arrayA->type).bit_width() /
+        8;
+    if (memcmp(arrayA->buffers[1]->data() + arrayA->offset * byteWidth,
+               arrayB->buffers[1]->data() + arrayB->offset * byteWidth,
+               arrayA->length * byteWidth) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Preallocated cursors do not check for overflows, so make sure the size
+/// pre-pass did not underestimate anything before filling.
+void checkRowCount(size_t filled, size_t reserved, char const *table) {
+  if (filled > reserved) {
+    throw std::runtime_error(std::string("Size pre-pass underestimated ") +
+                             table + " rows");
+  }
+}
+
+/// Per column values of the tracks of an event, filled from the AliESDtrack
+/// objects and then bulk appended to the TRACKPAR, TRACKPARCOV and
+/// TRACKEXTRA builders with one AppendValues per column, rather than
+/// scattering each track over all the builders. Storage is reused from one
+/// event to the next.
+struct StagedTracks {
+  std::vector<int> collisionId;
+  Run2ESDTrackReader::Columns par;
+  std::vector<float> tpcInnerParam;
+  std::vector<uint64_t> flags;
+  std::vector<uint8_t> itsClusterMap;
+  std::vector<uint16_t> tpcNCls;
+  std::vector<uint8_t> trdNTracklets;
+  std::vector<float> itsChi2NCl;
+  std::vector<float> tpcChi2NCl;
+  std::vector<float> trdChi2;
+  std::vector<float> tofChi2;
+  std::vector<float> tpcSignal;
+  std::vector<float> trdSignal;
+  std::vector<float> tofSignal;
+  std::vector<float> length;
+
+  /// Makes room for the @a n tracks of collision @a collision, in the
+  /// columns of the @a enabled tables only.
+  void resize(size_t n, int collision, TableSelection const &enabled) {
+    if (enabled[kTracks]) {
+      collisionId.assign(n, collision);
+      for (auto column : {&par.x, &par.alpha, &par.y, &par.z, &par.snp,
+                          &par.tgl, &par.signed1Pt}) {
+        column->resize(n);
+      }
+    }
+    if (enabled[kTracksCov]) {
+      for (auto &column : par.cov) {
+        column.resize(n);
+      }
+    }
+    if (enabled[kTracksExtra]) {
+      tpcInnerParam.resize(n);
+      flags.resize(n);
+      itsClusterMap.resize(n);
+      tpcNCls.resize(n);
+      trdNTracklets.resize(n);
+      for (auto column : {&itsChi2NCl, &tpcChi2NCl, &trdChi2, &tofChi2,
+                          &tpcSignal, &trdSignal, &tofSignal, &length}) {
+        column->resize(n);
+      }
+    }
+  }
+
+  /// Stores @a track as the @a i-th track of the event, with the same values
+  /// as the row by row filling in convertRange.
+  void stage(size_t i, AliESDtrack *track, TableSelection const &enabled) {
+    if (enabled[kTracks]) {
+      par.x[i] = track->GetX();
+      par.alpha[i] = track->GetAlpha();
+      par.y[i] = track->GetY();
+      par.z[i] = track->GetZ();
+      par.snp[i] = track->GetSnp();
+      par.tgl[i] = track->GetTgl();
+      par.signed1Pt[i] = track->GetSigned1Pt();
+    }
+    if (enabled[kTracksCov]) {
+      double const sigmas[15] = {
+          track->GetSigmaY2(),    track->GetSigmaZY(),
+          track->GetSigmaZ2(),    track->GetSigmaSnpY(),
+          track->GetSigmaSnpZ(),  track->GetSigmaSnp2(),
+          track->GetSigmaTglY(),  track->GetSigmaTglZ(),
+          track->GetSigmaTglSnp(), track->GetSigmaTgl2(),
+          track->GetSigma1PtY(),  track->GetSigma1PtZ(),
+          track->GetSigma1PtSnp(), track->GetSigma1PtTgl(),
+          track->GetSigma1Pt2()};
+      for (size_t ci = 0; ci < par.cov.size(); ++ci) {
+        par.cov[ci][i] = sigmas[ci];
+      }
+    }
+    if (enabled[kTracksExtra]) {
+      const AliExternalTrackParam *intp = track->GetTPCInnerParam();
+      tpcInnerParam[i] = intp ? intp->GetP() : 0;
+      flags[i] = track->GetStatus();
+      itsClusterMap[i] = track->GetITSClusterMap();
+      tpcNCls[i] = track->GetTPCNcls();
+      trdNTracklets[i] = track->GetTRDntracklets();
+      itsChi2NCl[i] =
+          track->GetITSNcls() ? track->GetITSchi2() / track->GetITSNcls() : 0;
+      tpcChi2NCl[i] =
+          track->GetTPCNcls() ? track->GetTPCchi2() / track->GetTPCNcls() : 0;
+      trdChi2[i] = track->GetTRDchi2();
+      tofChi2[i] = track->GetTOFchi2();
+      tpcSignal[i] = track->GetTPCsignal();
+      trdSignal[i] = track->GetTRDsignal();
+      tofSignal[i] = track->GetTOFsignal();
+      length[i] = track->GetIntegratedLength();
+    }
+  }
+};
+
+/// Tables which are row aligned, i.e. whose rows are filtered together.
+std::array<std::vector<AODTableId>, 3> const rowAlignedTables{
+    {{kTracks, kTracksCov, kTracksExtra}, {kCalos}, {kMuons}}};
+
+/// Keeps only the rows selected by @a filter in the tables of each group in
+/// rowAlignedTables whose columns are enough to evaluate it, updating
+/// @a range.rowsPerEntry so that indices stay consistent. The selection is
+/// evaluated on the (non empty) tables of a group joined together, so that
+/// e.g. track cuts can combine TRACKPAR and TRACKEXTRA columns.
+void applyFilter(ConvertedRange &range, expressions::Filter const &filter) {
+  bool applied = false;
+  for (size_t gi = 0; gi < rowAlignedTables.size(); ++gi) {
+    // Disabled tables are empty, hence the slices to check the columns.
+    std::vector<std::shared_ptr<arrow::Table>> schemas;
+    std::vector<std::shared_ptr<arrow::Table>> filled;
+    for (auto ti : rowAlignedTables[gi]) {
+      schemas.push_back(range.tables[ti]->Slice(0, 0));
+      if (range.tables[ti]->num_rows() != 0) {
+        filled.push_back(range.tables[ti]);
+      }
+    }
+    if (usesOnlyColumnsOf(*joinColumns(schemas), filter) == false) {
+      continue;
+    }
+    applied = true;
+    if (filled.empty()) {
+      continue;
+    }
+    auto rows = selectRows(joinColumns(filled), filter);
+    for (auto ti : rowAlignedTables[gi]) {
+      if (range.tables[ti]->num_rows() != 0) {
+        range.tables[ti] = takeRows(*range.tables[ti], rows);
+      }
+    }
+    // rowsPerEntry counts the rows of each entry before filtering, and rows
+    // are sorted, so each entry keeps the selected rows below its end.
+    int64_t entryEnd = 0;
+    size_t ri = 0;
+    for (auto &entry : range.rowsPerEntry) {
+      entryEnd += entry[gi];
+      int64_t kept = 0;
+      for (; ri < rows.size() && rows[ri] < entryEnd; ++ri) {
+        ++kept;
+      }
+      entry[gi] = kept;
+    }
+  }
+  if (applied == false) {
+    throw std::runtime_error(
+        "The filter uses columns of neither the tracks, the calo cells nor "
+        "the muons");
+  }
+}
+
+/// Converts the ESD entries [first, last) of @a tEsd, which must already be
+/// connected to @a esd. The collision id of entry iev is
+/// plan.collisionOffset + iev, i.e. its row in COLLISION once the ranges of
+/// all the converted files are concatenated, so that ranges converted
+/// independently can simply be concatenated. Tables which are in neither
+/// @a plan.object nor @a plan.direct are left empty. The latter are filled
+/// through @a trackReader.
+ConvertedRange convertRange(AliESDEvent *esd, TTree *tEsd,
+                            Run2ESDTrackReader *trackReader,
+                            ConversionPlan const &plan, size_t first,
+                            size_t last) {
+  auto const &enabled = plan.object;
+  RowCounts const expected = countRows(tEsd, enabled, first, last);
+  RowCounts filled;
+  size_t const nEntries = last - first;
+  size_t const expectedDirectTracks =
+      trackReader ? sumOverEntries(trackReader->tree(), "@Tracks.size()",
+                                   first, last)
+                  : 0;
+
+  TableBuilder trackParBuilder{plan.pools[kTracks]};
+  TableBuilder trackParCovBuilder{plan.pools[kTracksCov]};
+  TableBuilder trackExtraBuilder{plan.pools[kTracksExtra]};
+  TableBuilder caloBuilder{plan.pools[kCalos]};
+  TableBuilder muonBuilder{plan.pools[kMuons]};
+  TableBuilder v0Builder{plan.pools[kVZeros]};
+  TableBuilder collisionsBuilder{plan.pools[kCollisions]};
+
+  // Tracks are either appended one row at a time, or staged per event and
+  // bulk appended. Only one of the two sets of builders gets any row.
+  size_t const rowWiseTracks = plan.rowWiseTracks ? expected.tracks : 0;
+  size_t const stagedTracks = plan.rowWiseTracks ? 0 : expected.tracks;
+  auto trackFiller =
+      trackParBuilder.preallocatedCursor<aod::Tracks>(rowWiseTracks);
+  auto sigmaFiller =
+      trackParCovBuilder.preallocatedCursor<aod::TracksCov>(rowWiseTracks);
+  auto extraFiller =
+      trackExtraBuilder.preallocatedCursor<aod::TracksExtra>(rowWiseTracks);
+  TableBuilder stagedTrackParBuilder{plan.pools[kTracks]};
+  TableBuilder stagedTrackParCovBuilder{plan.pools[kTracksCov]};
+  TableBuilder stagedTrackExtraBuilder{plan.pools[kTracksExtra]};
+  auto trackStagedFiller =
+      stagedTrackParBuilder.bulkCursor<aod::Tracks>(stagedTracks);
+  auto sigmaStagedFiller =
+      stagedTrackParCovBuilder.bulkCursor<aod::TracksCov>(stagedTracks);
+  auto extraStagedFiller =
+      stagedTrackExtraBuilder.bulkCursor<aod::TracksExtra>(stagedTracks);
+  StagedTracks staged;
+  auto caloFiller = caloBuilder.preallocatedCursor<aod::Calos>(expected.calos);
+  auto muonFiller = muonBuilder.preallocatedCursor<aod::Muons>(expected.muons);
+  auto vzeroFiller = v0Builder.preallocatedCursor<aod::VZeros>(nEntries);
+  auto collisionFiller =
+      collisionsBuilder.preallocatedCursor<aod::Collisions>(nEntries);
+
+  // Direct reading appends all the tracks of an event at once.
+  TableBuilder directTrackParBuilder{plan.pools[kTracks]};
+  TableBuilder directTrackParCovBuilder{plan.pools[kTracksCov]};
+  auto trackBulkFiller =
+      directTrackParBuilder.bulkCursor<aod::Tracks>(expectedDirectTracks);
+  auto sigmaBulkFiller =
+      directTrackParCovBuilder.bulkCursor<aod::TracksCov>(expectedDirectTracks);
+  std::vector<int> collisionIds;
+
+  ConvertedRange result;
+  size_t &ncalo = result.ncalo;
+  bool const fillTracks =
+      enabled[kTracks] || enabled[kTracksCov] || enabled[kTracksExtra];
+
+  for (size_t iev = first; iev < last; ++iev) {
     esd->Reset();
     tEsd->GetEntry(iev);
     esd->ConnectTracks();
+    int const collisionId = plan.collisionOffset + iev;
 
     // Tracks information
-    ntrk = esd->GetNumberOfTracks();
-    for (size_t itrk = 0; itrk < ntrk; ++itrk) {
+    size_t ntrk = esd->GetNumberOfTracks();
+    size_t const nFilledTracks = fillTracks ? ntrk : 0;
+    checkRowCount(filled.tracks += nFilledTracks, expected.tracks, "TRACKPAR");
+    if (plan.rowWiseTracks == false) {
+      staged.resize(nFilledTracks, collisionId, enabled);
+    }
+    for (size_t itrk = 0; itrk < nFilledTracks; ++itrk) {
       AliESDtrack *track = esd->GetTrack(itrk);
       track->SetESDEvent(esd);
-      trackFiller(0, iev, track->GetX(), track->GetAlpha(), track->GetY(),
-                  track->GetZ(), track->GetSnp(), track->GetTgl(),
-                  track->GetSigned1Pt());
-
-      sigmaFiller(
-          0, track->GetSigmaY2(), track->GetSigmaZY(), track->GetSigmaZ2(),
-          track->GetSigmaSnpY(), track->GetSigmaSnpZ(), track->GetSigmaSnp2(),
-          track->GetSigmaTglY(), track->GetSigmaTglZ(), track->GetSigmaTglSnp(),
-          track->GetSigmaTgl2(), track->GetSigma1PtY(), track->GetSigma1PtZ(),
-          track->GetSigma1PtSnp(), track->GetSigma1PtTgl(),
-          track->GetSigma1Pt2());
+      if (plan.rowWiseTracks == false) {
+        staged.stage(itrk, track, enabled);
+        continue;
+      }
+      if (enabled[kTracks]) {
+        trackFiller(0, collisionId, track->GetX(), track->GetAlpha(),
+                    track->GetY(), track->GetZ(), track->GetSnp(),
+                    track->GetTgl(), track->GetSigned1Pt());
+      }
+
+      if (enabled[kTracksCov]) {
+        sigmaFiller(
+            0, track->GetSigmaY2(), track->GetSigmaZY(), track->GetSigmaZ2(),
+            track->GetSigmaSnpY(), track->GetSigmaSnpZ(),
+            track->GetSigmaSnp2(), track->GetSigmaTglY(),
+            track->GetSigmaTglZ(), track->GetSigmaTglSnp(),
+            track->GetSigmaTgl2(), track->GetSigma1PtY(),
+            track->GetSigma1PtZ(), track->GetSigma1PtSnp(),
+            track->GetSigma1PtTgl(), track->GetSigma1Pt2());
+      }
+
+      if (enabled[kTracksExtra] == false) {
+        continue;
+      }
       const AliExternalTrackParam *intp = track->GetTPCInnerParam();
 
       extraFiller(
@@ -123,11 +882,62 @@ void Run3AODConverter::convert(TTree *tEsd,
           track->GetIntegratedLength());
     } // End loop on tracks
 
+    if (plan.rowWiseTracks == false && nFilledTracks != 0) {
+      auto const &par = staged.par;
+      if (enabled[kTracks]) {
+        trackStagedFiller(0, nFilledTracks, staged.collisionId.data(),
+                          par.x.data(), par.alpha.data(), par.y.data(),
+                          par.z.data(), par.snp.data(), par.tgl.data(),
+                          par.signed1Pt.data());
+      }
+      if (enabled[kTracksCov]) {
+        auto const &cov = par.cov;
+        sigmaStagedFiller(0, nFilledTracks, cov[0].data(), cov[1].data(),
+                          cov[2].data(), cov[3].data(), cov[4].data(),
+                          cov[5].data(), cov[6].data(), cov[7].data(),
+                          cov[8].data(), cov[9].data(), cov[10].data(),
+                          cov[11].data(), cov[12].data(), cov[13].data(),
+                          cov[14].data());
+      }
+      if (enabled[kTracksExtra]) {
+        extraStagedFiller(
+            0, nFilledTracks, staged.tpcInnerParam.data(),
+            staged.flags.data(), staged.itsClusterMap.data(),
+            staged.tpcNCls.data(), staged.trdNTracklets.data(),
+            staged.itsChi2NCl.data(), staged.tpcChi2NCl.data(),
+            staged.trdChi2.data(), staged.tofChi2.data(),
+            staged.tpcSignal.data(), staged.trdSignal.data(),
+            staged.tofSignal.data(), staged.length.data());
+      }
+    }
+
+    if (trackReader) {
+      ntrk = trackReader->readEntry(iev);
+      auto const &columns = trackReader->columns();
+      if (plan.direct[kTracks]) {
+        collisionIds.assign(ntrk, collisionId);
+        trackBulkFiller(0, ntrk, collisionIds.data(), columns.x.data(),
+                        columns.alpha.data(), columns.y.data(),
+                        columns.z.data(), columns.snp.data(),
+                        columns.tgl.data(), columns.signed1Pt.data());
+      }
+      if (plan.direct[kTracksCov]) {
+        auto const &cov = columns.cov;
+        sigmaBulkFiller(0, ntrk, cov[0].data(), cov[1].data(), cov[2].data(),
+                        cov[3].data(), cov[4].data(), cov[5].data(),
+                        cov[6].data(), cov[7].data(), cov[8].data(),
+                        cov[9].data(), cov[10].data(), cov[11].data(),
+                        cov[12].data(), cov[13].data(), cov[14].data());
+      }
+    }
+
     // Calorimeters:
     // EMCAL
     AliESDCaloCells *cells = esd->GetEMCALCells();
-    size_t nCells = cells->GetNumberOfCells();
+    size_t nCells = enabled[kCalos] ? cells->GetNumberOfCells() : 0;
+    size_t caloRows = nCells;
     ncalo += nCells;
+    checkRowCount(filled.calos += nCells, expected.calos, "CALO");
     auto cellType = cells->GetType();
     // FIXME: this should retrieve the caloType
     auto caloType = 0;
@@ -139,13 +949,16 @@ void Run3AODConverter::convert(TTree *tEsd,
       Double_t efrac;
 
       cells->GetCell(ice, cellNumber, amplitude, time, mclabel, efrac);
-      caloFiller(0, iev, cellNumber, amplitude, time, cellType, caloType);
+      caloFiller(0, collisionId, cellNumber, amplitude, time, cellType,
+                 caloType);
     }
 
     // PHOS
     cells = esd->GetPHOSCells();
-    nCells = cells->GetNumberOfCells();
+    nCells = enabled[kCalos] ? cells->GetNumberOfCells() : 0;
+    caloRows += nCells;
     ncalo += nCells;
+    checkRowCount(filled.calos += nCells, expected.calos, "CALO");
     cellType = cells->GetType();
     caloType = 0;
     for (size_t icp = 0; icp < nCells; ++icp) {
@@ -156,11 +969,13 @@ void Run3AODConverter::convert(TTree *tEsd,
       Double_t efrac;
 
       cells->GetCell(icp, cellNumber, amplitude, time, mclabel, efrac);
-      caloFiller(0, iev, cellNumber, amplitude, time, caloType, cellType);
+      caloFiller(0, collisionId, cellNumber, amplitude, time, caloType,
+                 cellType);
     }
 
     // Muon Tracks
-    nmu = esd->GetNumberOfMuonTracks();
+    size_t const nmu = enabled[kMuons] ? esd->GetNumberOfMuonTracks() : 0;
+    checkRowCount(filled.muons += nmu, expected.muons, "MUON");
     for (size_t imu = 0; imu < nmu; ++imu) {
       AliESDMuonTrack *mutrk = esd->GetMuonTrack(imu);
       //
@@ -172,9 +987,9 @@ void Run3AODConverter::convert(TTree *tEsd,
       //      //
       //
       //
-      muonFiller(0, iev, mutrk->GetInverseBendingMomentum(), mutrk->GetThetaX(),
-                 mutrk->GetThetaY(), mutrk->GetZ(), mutrk->GetBendingCoor(),
-                 mutrk->GetNonBendingCoor(),
+      muonFiller(0, collisionId, mutrk->GetInverseBendingMomentum(),
+                 mutrk->GetThetaX(), mutrk->GetThetaY(), mutrk->GetZ(),
+                 mutrk->GetBendingCoor(), mutrk->GetNonBendingCoor(),
                  // covariance matrix goes here...
                  mutrk->GetChi2(), mutrk->GetChi2MatchTrigger());
     }
@@ -186,75 +1001,394 @@ void Run3AODConverter::convert(TTree *tEsd,
       //  fTimeVZ[ich] = vz->GetTime(ich);
       //  fWidthVZ[ich] = vz->GetWidth(ich);
     }
-    vzeroFiller(0, iev, 0, 0);
-    AliESDVertex const *vertex = esd->GetVertex();
-    // FIXME: timeframeid is dummy
-    // FIXME: last few entries are obviously dummy
-    collisionFiller(0, 0, ntrk, iev, vertex->GetX(), vertex->GetY(),
-                    vertex->GetZ(), vertex->GetChi2(), vertex->GetBC(), 0, 0, 0, 
-                    0, 0, 0, 0);
+    if (enabled[kVZeros]) {
+      vzeroFiller(0, collisionId, 0, 0);
+      ++result.nvzero;
+    }
+    size_t const trackRows = fillTracks || trackReader ? ntrk : 0;
+    result.ntrk += trackRows;
+    result.nmu += nmu;
+    if (enabled[kCollisions]) {
+      result.rowsPerEntry.push_back({static_cast<int64_t>(trackRows),
+                                     static_cast<int64_t>(caloRows),
+                                     static_cast<int64_t>(nmu)});
+      AliESDVertex const *vertex = esd->GetVertex();
+      // XX, XY, YY, XZ, YZ, ZZ
+      Double_t cov[6];
+      vertex->GetCovarianceMatrix(cov);
+      // FIXME: the event time is dummy
+      collisionFiller(0, collisionId, vertex->GetX(), vertex->GetY(),
+                      vertex->GetZ(), cov[0], cov[1], cov[3], cov[2], cov[4],
+                      cov[5], vertex->GetChi2(), vertex->GetNContributors(), 0,
+                      0, 0);
+    }
   } // Loop on events
-  //
-  std::vector<std::shared_ptr<arrow::Table>> tables;
-  if (ntrk) {
-    appendTable<aod::Tracks>(tables, trackParBuilder);
-    appendTable<aod::TracksCov>(tables, trackParCovBuilder);
-    appendTable<aod::TracksExtra>(tables, trackExtraBuilder);
+
+  result.tables[kTracks] = makeTable<aod::Tracks>(
+      plan.rowWiseTracks ? trackParBuilder : stagedTrackParBuilder);
+  result.tables[kTracksCov] = makeTable<aod::TracksCov>(
+      plan.rowWiseTracks ? trackParCovBuilder : stagedTrackParCovBuilder);
+  std::array<TableBuilder *, kNAODTables> directBuilders{
+      &directTrackParBuilder, &directTrackParCovBuilder};
+  for (auto ti : {kTracks, kTracksCov}) {
+    if (plan.direct[ti] == false) {
+      continue;
+    }
+    auto direct = ti == kTracks
+                      ? makeTable<aod::Tracks>(*directBuilders[ti])
+                      : makeTable<aod::TracksCov>(*directBuilders[ti]);
+    if (plan.verify[ti] &&
+        identicalTables(*direct, *result.tables[ti]) == false) {
+      throw std::runtime_error(std::string("Direct reading of ") +
+                               aodTableNames[ti] +
+                               " differs from the AliESDtrack one");
+    }
+    result.tables[ti] = direct;
   }
-  if (ncalo) {
-    appendTable<aod::Calos>(tables, caloBuilder);
+  result.tables[kTracksExtra] = makeTable<aod::TracksExtra>(
+      plan.rowWiseTracks ? trackExtraBuilder : stagedTrackExtraBuilder);
+  result.tables[kCalos] = makeTable<aod::Calos>(caloBuilder);
+  result.tables[kMuons] = makeTable<aod::Muons>(muonBuilder);
+  result.tables[kVZeros] = makeTable<aod::VZeros>(v0Builder);
+  result.tables[kCollisions] = makeTable<aod::Collisions>(collisionsBuilder);
+  if (plan.filter) {
+    applyFilter(result, *plan.filter);
   }
-  if (nmu) {
-    appendTable<aod::Muons>(tables, muonBuilder);
+  for (auto &table : result.tables) {
+    reducePrecision(*table, plan.precisions);
   }
-  if (nvzero) {
-    appendTable<aod::VZeros>(tables, v0Builder);
+  return result;
+}
+
+/// Prints the allocation statistics of the builders of each table, since the
+/// start of the process.
+void printMemoryReport(Run3AODConverter::Options const &options) {
+  if (options.arenaMemoryPool == false) {
+    std::cerr << "Memory report: " << arrow::default_memory_pool()->max_memory()
+              << " bytes at peak in the default pool" << std::endl;
+    return;
   }
+  std::vector<std::pair<std::string, ArenaMemoryPool::Stats>> pools;
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    pools.emplace_back(aodTableNames[ti], arenaPools()[ti].stats());
+  }
+  printMemoryStats(std::cerr, pools);
+}
 
-  if (nev) {
-    appendTable<aod::Collisions>(tables, collisionsBuilder);
+/// Splits the entries to be converted into chunks, converts them (possibly on
+/// several worker threads) and hands the result of each chunk to @a consumer,
+/// on the calling thread and strictly in entry order. At most a couple of
+/// chunks per worker are kept in memory at any given time.
+template <typename CONSUMER>
+void convertChunks(TTree *tEsd, ConversionPlan const &plan,
+                   Run3AODConverter::Options const &options,
+                   std::vector<std::pair<size_t, size_t>> const &chunks,
+                   size_t nWorkers, FileIO &fileIO, CONSUMER &&consumer) {
+  Long64_t const first = chunks.empty() ? 0 : chunks.front().first;
+  Long64_t const last = chunks.empty() ? 0 : chunks.back().second;
+  std::string filename = tEsd->GetCurrentFile()->GetName();
+  std::string treename = tEsd->GetName();
+  auto makeTrackReader = [&]() -> std::unique_ptr<Run2ESDTrackReader> {
+    if (plan.needsTrackReader() == false) {
+      return nullptr;
+    }
+    return std::make_unique<Run2ESDTrackReader>(
+        filename, treename, plan.direct[kTracks], plan.direct[kTracksCov]);
+  };
+
+  if (nWorkers <= 1) {
+    AliESDEvent *esd = new AliESDEvent();
+    esd->ReadFromTree(tEsd);
+    selectBranches(tEsd, plan);
+    setupTreeCache(tEsd, options, first, last);
+    auto trackReader = makeTrackReader();
+    TFile *infile = tEsd->GetCurrentFile();
+    Long64_t bytesBefore = infile->GetBytesRead();
+    Int_t callsBefore = infile->GetReadCalls();
+    for (auto &chunk : chunks) {
+      consumer(convertRange(esd, tEsd, trackReader.get(), plan, chunk.first,
+                            chunk.second));
+    }
+    fileIO.add(infile, bytesBefore, callsBefore);
+    return;
   }
 
-  appendTable<aod::Timeframes>(tables, timeframeBuilder);
+  ROOT::EnableThreadSafety();
+  size_t const maxInFlight = 2 * nWorkers;
 
-  /// Writing to a stream
-  for (auto &table : tables) {
-    std::unordered_map<std::string, std::string> meta;
-    table->schema()->metadata()->ToUnorderedMap(&meta);
-    std::cerr << "Writing table: " << meta["description"] << " ... ";
-    arrow::TableBatchReader reader(*table);
-    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
-    auto outBatch = arrow::ipc::RecordBatchStreamWriter::Open(
-        stream.get(), reader.schema(), &writer);
-    if (outBatch.ok() == false) {
-      std::runtime_error("Unable to open writer");
-    }
-    std::shared_ptr<arrow::RecordBatch> batch;
-
-    while (true) {
-      auto status = reader.ReadNext(&batch);
-      if (status.ok() != true) {
-        std::runtime_error("Error while processing table");
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<size_t, ConvertedRange> done;
+  std::exception_ptr error;
+  size_t nextChunk = 0;
+  size_t nextToConsume = 0;
+
+  auto worker = [&]() {
+    try {
+      // Each worker opens its own TFile so that no ROOT I/O object is shared
+      // between threads. Connecting the AliESDEvent touches global ROOT /
+      // AliLog state, hence the lock.
+      std::unique_ptr<TFile> infile;
+      std::unique_ptr<AliESDEvent> esd;
+      std::unique_ptr<Run2ESDTrackReader> trackReader;
+      TTree *tree = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        infile.reset(TFile::Open(filename.c_str()));
+        if (!infile || infile->IsZombie()) {
+          throw std::runtime_error("Unable to open " + filename);
+        }
+        tree = (TTree *)infile->Get(treename.c_str());
+        if (tree == nullptr) {
+          throw std::runtime_error("Unable to find " + treename + " in " +
+                                   filename);
+        }
+        esd = std::make_unique<AliESDEvent>();
+        esd->ReadFromTree(tree);
+        selectBranches(tree, plan);
+        setupTreeCache(tree, options, first, last);
+        trackReader = makeTrackReader();
+      }
+      while (true) {
+        size_t ci;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() {
+            return error || nextChunk >= chunks.size() ||
+                   nextChunk < nextToConsume + maxInFlight;
+          });
+          if (error || nextChunk >= chunks.size()) {
+            fileIO.add(infile.get(), 0, 0);
+            return;
+          }
+          ci = nextChunk++;
+        }
+        auto range = convertRange(esd.get(), tree, trackReader.get(), plan,
+                                  chunks[ci].first, chunks[ci].second);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          done.emplace(ci, std::move(range));
+        }
+        cv.notify_all();
       }
-      if (batch == nullptr) {
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t wi = 0; wi < nWorkers; ++wi) {
+    workers.emplace_back(worker);
+  }
+
+  while (nextToConsume < chunks.size()) {
+    ConvertedRange range;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock,
+              [&]() { return error || done.count(nextToConsume) != 0; });
+      if (error) {
         break;
       }
-      // Align the stream to 8 bytes, as requested by Arrow
-      auto outStatus = writer->WriteRecordBatch(*batch);
+      auto it = done.find(nextToConsume);
+      range = std::move(it->second);
+      done.erase(it);
     }
-    if (writer->Close().ok() != true) {
-      std::runtime_error("Unable to close file");
+    try {
+      consumer(std::move(range));
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
     }
-    std::cerr << "[DONE]" << std::endl;
-    int64_t pos;
-    stream->Tell(&pos);
-    if (pos % 8 != 0) {
-      int64_t extra = 0;
-      stream->Write(&extra, 8 - (pos % 8));
-      std::cerr << "moving stream " << 8 - (pos % 8)
-                << " positions to align ... " << std::endl;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++nextToConsume;
     }
+    cv.notify_all();
+  }
+
+  for (auto &w : workers) {
+    w.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace
+
+void Run3AODConverter::prepare(TTree *tEsd, Options const &options) {
+  size_t nev = entriesToConvert(tEsd, options);
+  if (std::min(options.nThreads, nev) > 1) {
+    return;
+  }
+  ConversionPlan const plan = planConversion(options, enabledTables(options));
+  selectBranches(tEsd, plan);
+  setupTreeCache(tEsd, options, 0, nev);
+  if (nev > 0) {
+    tEsd->LoadTree(0);
+    if (auto cache = tEsd->GetReadCache(tEsd->GetCurrentFile())) {
+      cache->FillBuffer();
+    }
+  }
+}
+
+Run3AODConverter::Offsets Run3AODConverter::convert(TTree *tEsd,
+                                                    TableSink &sink,
+                                                    Options const &options) {
+  size_t nev = entriesToConvert(tEsd, options);
+  if (options.offsets.collisions + nev >
+      size_t(std::numeric_limits<int32_t>::max())) {
+    throw std::runtime_error("Collision ids do not fit in fCollisionsID");
+  }
+  size_t nWorkers = std::max<size_t>(1, std::min(options.nThreads, nev));
+
+  TableSelection const enabled = enabledTables(options);
+  ConversionPlan plan = planConversion(options, enabled);
+  if (options.reducePrecision) {
+    plan.precisions = esdColumnPrecisions(tEsd->GetCurrentFile());
+    if (options.ioReport) {
+      printColumnPrecisions(std::cerr, plan.precisions);
+    }
+  }
+  if (options.filter.empty() == false) {
+    plan.filter = parseFilter(options.filter);
+  }
+  FileIO fileIO;
+  bool const writeTimeframes =
+      options.tables.empty() ||
+      options.tables.count(aod::TimeframesMetadata::mDescription);
+
+  // Without batching each worker gets one contiguous slice of the input,
+  // otherwise the input is cut in batches of options.batchEvents entries
+  // which are written out as soon as they are ready.
+  std::vector<std::pair<size_t, size_t>> chunks;
+  if (options.batchEvents > 0) {
+    for (size_t first = 0; first < nev; first += options.batchEvents) {
+      chunks.emplace_back(first, std::min(nev, first + options.batchEvents));
+    }
+  } else {
+    for (size_t wi = 0; wi < nWorkers; ++wi) {
+      chunks.emplace_back(nev * wi / nWorkers, nev * (wi + 1) / nWorkers);
+    }
+  }
+
+  // Where the rows written next start, advanced past each table written.
+  Offsets offsets = options.offsets;
+  offsets.collisions += nev;
+
+  TableBuilder timeframeBuilder;
+  auto timeframeFiller = timeframeBuilder.cursor<aod::Timeframes>();
+  // FIXME: what should we put as a timestamp for the timeframe??
+  timeframeFiller(0, 0);
+
+  if (options.batchEvents > 0) {
+    // Every batch is a complete set of streams, one per non empty table, so
+    // that readers can start consuming while the conversion is still going.
+    // Batches come in entry order, rows carry on from the previous one.
+    convertChunks(tEsd, plan, options, chunks, nWorkers, fileIO,
+                  [&sink, &options, &offsets](ConvertedRange &&range) {
+                    std::vector<std::shared_ptr<arrow::Table>> tables;
+                    for (size_t ti = 0; ti < kNAODTables; ++ti) {
+                      if (range.tables[ti]->num_rows() != 0) {
+                        appendOutputTable(tables, range, ti, options, offsets);
+                      }
+                    }
+                    if (range.rowsPerEntry.empty() == false) {
+                      tables.push_back(
+                          makeCollisionGroups(range.rowsPerEntry, offsets));
+                    }
+                    advanceOffsets(offsets, range);
+                    for (auto &table : tables) {
+                      sink.write(table);
+                    }
+                    sink.flush();
+                  });
+    if (options.ioReport) {
+      printIOReport(tEsd, plan, 0, nev, fileIO);
+    }
+    if (options.memoryReport) {
+      printMemoryReport(options);
+    }
+    if (writeTimeframes) {
+      sink.write(makeTable<aod::Timeframes>(timeframeBuilder));
+    }
+    return offsets;
+  }
+
+  std::vector<ConvertedRange> ranges;
+  convertChunks(tEsd, plan, options, chunks, nWorkers, fileIO,
+                [&ranges](ConvertedRange &&range) {
+                  ranges.emplace_back(std::move(range));
+                });
+  if (options.ioReport) {
+    printIOReport(tEsd, plan, 0, nev, fileIO);
+  }
+  if (options.memoryReport) {
+    printMemoryReport(options);
+  }
+
+  // Stitch the per worker tables back together in event order. Counters
+  // follow what a single pass over [0, nev) would have produced.
+  ConvertedRange merged;
+  for (size_t ti = 0; ti < kNAODTables; ++ti) {
+    std::vector<std::shared_ptr<arrow::Table>> pieces;
+    for (auto &range : ranges) {
+      pieces.push_back(range.tables[ti]);
+    }
+    if (pieces.size() == 1) {
+      merged.tables[ti] = pieces[0];
+    } else if (arrow::ConcatenateTables(pieces, &merged.tables[ti]).ok() ==
+               false) {
+      throw std::runtime_error("Unable to concatenate worker tables");
+    }
+  }
+  for (auto &range : ranges) {
+    merged.rowsPerEntry.insert(merged.rowsPerEntry.end(),
+                               range.rowsPerEntry.begin(),
+                               range.rowsPerEntry.end());
+    merged.ntrk += range.ntrk;
+    merged.nmu += range.nmu;
+    merged.ncalo += range.ncalo;
+    merged.nvzero += range.nvzero;
+  }
+
+  // The counters are taken before filtering, what is left is in the tables.
+  std::vector<std::shared_ptr<arrow::Table>> tables;
+  for (auto ti : {kTracks, kTracksCov, kTracksExtra, kCalos, kMuons}) {
+    if (enabled[ti] && merged.tables[ti]->num_rows() != 0) {
+      appendOutputTable(tables, merged, ti, options, offsets);
+    }
+  }
+  if (merged.nvzero) {
+    tables.push_back(merged.tables[kVZeros]);
+  }
+
+  if (nev && enabled[kCollisions]) {
+    tables.push_back(merged.tables[kCollisions]);
+    tables.push_back(makeCollisionGroups(merged.rowsPerEntry, offsets));
+  }
+  if (nev) {
+    advanceOffsets(offsets, merged);
+  }
+
+  if (writeTimeframes) {
+    tables.push_back(makeTable<aod::Timeframes>(timeframeBuilder));
+  }
+
+  for (auto &table : tables) {
+    sink.write(table);
   }
+  sink.flush();
+  return offsets;
 }
 
 } // namespace o2::framework::run2
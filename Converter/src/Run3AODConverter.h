@@ -10,24 +10,111 @@
 #ifndef o2_framework_run2_Run3AODConverter_H_INCLUDED
 #define o2_framework_run2_Run3AODConverter_H_INCLUDED
 
+#include <cstddef>
 #include <memory>
+#include <set>
+#include <string>
 
 class TTree;
 
-namespace arrow {
-namespace io {
-class OutputStream;
-}
-} // namespace arrow
-
 namespace o2::framework::run2 {
 
+class TableSink;
+
 /// Helpers for the Run2 ESD to Run3 AOD conversion.
 struct Run3AODConverter {
+  /// Where the rows of a conversion start in the output, so that several
+  /// conversions written to the same output (see convertFiles() in
+  /// ConversionPipeline.h), or the batches of a conversion, refer to rows of
+  /// the concatenated tables.
+  struct Offsets {
+    /// Collision id of the first converted entry. Entries get consecutive
+    /// ids, used as fCollisionsID of the per collision tables and as
+    /// fEventId of COLLISION, so that the id of a collision is its row in
+    /// the concatenated COLLISION table.
+    size_t collisions = 0;
+    /// First row of the tracks (TRACKPAR, TRACKPARCOV and TRACKEXTRA are row
+    /// aligned), calo cells and muons, as used by COLLISIONGROUP and by the
+    /// collision ranges.
+    int64_t tracks = 0;
+    int64_t calos = 0;
+    int64_t muons = 0;
+  };
+
+  /// Knobs which steer the conversion of a single ESD tree.
+  struct Options {
+    /// Maximum number of events to convert. 0 means all of them.
+    size_t nEvents = 0;
+    /// Number of workers converting disjoint entry ranges in parallel. Each
+    /// worker reopens the input file, so that it owns its TTree and
+    /// AliESDEvent.
+    size_t nThreads = 1;
+    /// When non zero, tables are finalized and written out every
+    /// batchEvents events, keeping memory usage flat. Each batch is written
+    /// as a separate stream per table.
+    size_t batchEvents = 0;
+    /// Descriptions (e.g. TRACKPAR) of the AOD tables to produce. Empty means
+    /// all of them. Only the ESD branches needed by these tables are read.
+    std::set<std::string> tables;
+    /// Tables (TRACKPAR and / or TRACKPARCOV) which are filled straight from
+    /// the split Tracks leaves, without building any AliESDtrack. The other
+    /// track tables must then be disabled, and the track count of COLLISION
+    /// is taken from the leaves as well.
+    std::set<std::string> directRead;
+    /// Fill the directRead tables through the AliESDtrack objects as well and
+    /// fail if the two differ.
+    bool verifyDirectRead = false;
+    /// Size in bytes of the TTreeCache. 0 means two clusters worth of the
+    /// enabled branches.
+    size_t cacheSize = 0;
+    /// Decompress baskets on the ROOT implicit MT pool, which the caller
+    /// must have enabled (ROOT::EnableImplicitMT) with this many threads. 0
+    /// means baskets are decompressed on the conversion threads.
+    size_t unzipThreads = 0;
+    /// Print the bytes read vs. the bytes used for each ESD branch.
+    bool ioReport = false;
+    /// Round the float columns filled from Double32_t ESD members to the
+    /// precision those members are stored with, see ColumnPrecision.h, so
+    /// that they compress better.
+    bool reducePrecision = false;
+    /// Replace the fCollisionsID column of TRACKPAR, CALO and MUON with the
+    /// TRACKPARRANGE, CALORANGE and MUONRANGE tables, holding the offset and
+    /// number of rows of each collision.
+    bool collisionRanges = false;
+    /// Filter expression (see parseFilter in RowFilter.h) selecting the
+    /// tracks, calo cells or muons to write out. Each batch is filtered
+    /// before being written and COLLISIONGROUP and the collision ranges
+    /// only count the selected rows. Empty keeps all of them.
+    std::string filter;
+    /// Fill the track tables one row at a time, as opposed to staging the
+    /// tracks of each event in per column arrays which are then appended in
+    /// bulk. Only meant for comparisons, see benchmarkTrackFilling.
+    bool rowWiseTracks = false;
+    /// Allocate the tables from per table arenas of huge pages (see
+    /// ArenaMemoryPool.h) rather than from the default Arrow pool. An arena
+    /// is shared by all the column builders of its table and by all the
+    /// workers, so only the most recent allocation grows in place, hence
+    /// this is opt-in until it is shown to beat the default pool.
+    bool arenaMemoryPool = false;
+    /// Print, at the end of the conversion, the allocations, reallocations
+    /// and peak memory of the builders of each table.
+    bool memoryReport = false;
+    /// Where the conversion starts in the output, see Offsets.
+    Offsets offsets;
+  };
+
+  /// Gets @a tESD ready for convert(): selects the ESD branches, sets up the
+  /// TTreeCache and fetches the first cluster. This is meant to be called
+  /// ahead of time, while another tree is being converted. When several
+  /// conversion threads are used each of them reopens the file, so there is
+  /// nothing to prepare.
+  static void prepare(TTree *tESD, Options const &options);
+
   // Helper to return a callback which is able to conver a Run2 ESD file to an
-  // Arrow Table which then gets streamed to an ostream.
-  static void convert(TTree *tESD, std::shared_ptr<arrow::io::OutputStream> s,
-                      size_t nEvents);
+  // Arrow Table which then gets written to @a sink. Returns the offsets of a
+  // conversion appended after this one, i.e. options.offsets advanced by the
+  // rows written.
+  static Offsets convert(TTree *tESD, TableSink &sink, Options const &options);
 };
 
 } // namespace o2::framework::run2
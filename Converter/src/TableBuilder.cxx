@@ -10,10 +10,12 @@
 
 #include "Framework/TableBuilder.h"
 #include <memory>
+#include <stdexcept>
 #if defined(__GNUC__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wshadow"
 #endif
+#include <arrow/array.h>
 #include <arrow/builder.h>
 #include <arrow/memory_pool.h>
 #include <arrow/record_batch.h>
@@ -63,5 +65,18 @@ std::shared_ptr<arrow::Table>
   return table_;
 }
 
+void RunLengthIndexBuilder::append(arrow::Column const& column)
+{
+  if (column.type()->id() != arrow::Type::INT32) {
+    throw std::runtime_error("Run length index requires an int32 column");
+  }
+  for (auto& chunk : column.data()->chunks()) {
+    auto values = std::static_pointer_cast<arrow::Int32Array>(chunk);
+    for (int64_t i = 0; i < values->length(); ++i) {
+      append(values->Value(i));
+    }
+  }
+}
+
 } // namespace framework
 } // namespace o2
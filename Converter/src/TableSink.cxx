@@ -0,0 +1,227 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#include "TableSink.h"
+#include "MappedAODFile.h"
+
+#include <arrow/buffer.h>
+#include <arrow/io/file.h>
+#include <arrow/io/memory.h>
+#include <arrow/memory_pool.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/record_batch.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+#include <arrow/util/key_value_metadata.h>
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace o2::framework::run2 {
+
+namespace {
+std::string tableDescription(arrow::Table const &table) {
+  std::unordered_map<std::string, std::string> meta;
+  table.schema()->metadata()->ToUnorderedMap(&meta);
+  return meta["description"];
+}
+
+/// Writes @a table as a self contained Arrow stream, followed by the padding
+/// needed to keep the next stream 8 bytes aligned. Returns the size of the
+/// stream, without the padding.
+int64_t writeTable(arrow::io::OutputStream *stream,
+                   std::shared_ptr<arrow::Table> const &table) {
+  int64_t start;
+  stream->Tell(&start);
+  std::unordered_map<std::string, std::string> meta;
+  table->schema()->metadata()->ToUnorderedMap(&meta);
+  std::cerr << "Writing table: " << meta["description"] << " ... ";
+  arrow::TableBatchReader reader(*table);
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+  auto outBatch =
+      arrow::ipc::RecordBatchStreamWriter::Open(stream, reader.schema(), &writer);
+  if (outBatch.ok() == false) {
+    throw std::runtime_error("Unable to open writer");
+  }
+  std::shared_ptr<arrow::RecordBatch> batch;
+
+  while (true) {
+    auto status = reader.ReadNext(&batch);
+    if (status.ok() != true) {
+      throw std::runtime_error("Error while processing table");
+    }
+    if (batch == nullptr) {
+      break;
+    }
+    // Align the stream to 8 bytes, as requested by Arrow
+    auto outStatus = writer->WriteRecordBatch(*batch);
+    if (outStatus.ok() == false) {
+      throw std::runtime_error("Unable to write record batch: " +
+                               outStatus.ToString());
+    }
+  }
+  if (writer->Close().ok() != true) {
+    throw std::runtime_error("Unable to close file");
+  }
+  std::cerr << "[DONE]" << std::endl;
+  int64_t pos;
+  stream->Tell(&pos);
+  if (pos % 8 != 0) {
+    int64_t extra = 0;
+    if (stream->Write(&extra, 8 - (pos % 8)).ok() == false) {
+      throw std::runtime_error("Unable to align the stream");
+    }
+    std::cerr << "moving stream " << 8 - (pos % 8)
+              << " positions to align ... " << std::endl;
+  }
+  return pos - start;
+}
+
+} // namespace
+
+StreamTableSink::StreamTableSink(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    CompressionPolicy compression)
+    : mStream{std::move(stream)},
+      mIndexed{std::dynamic_pointer_cast<MappedAODOutputStream>(mStream)},
+      mCompression{std::move(compression)} {}
+
+void StreamTableSink::write(std::shared_ptr<arrow::Table> const &table) {
+  AODIndexEntry entry;
+  entry.description = tableDescription(*table);
+  entry.rows = table->num_rows();
+  mStream->Tell(&entry.offset);
+  auto codec = mCompression.codecFor(entry.description);
+  if (codec == arrow::Compression::UNCOMPRESSED) {
+    entry.length = writeTable(mStream.get(), table);
+    if (mIndexed) {
+      mIndexed->addIndexEntry(std::move(entry));
+    }
+    return;
+  }
+  std::shared_ptr<arrow::io::BufferOutputStream> buffer;
+  std::shared_ptr<arrow::Buffer> stream;
+  if (arrow::io::BufferOutputStream::Create(
+          1 << 20, arrow::default_memory_pool(), &buffer)
+          .ok() == false) {
+    throw std::runtime_error("Unable to create the compression buffer");
+  }
+  writeTable(buffer.get(), table);
+  if (buffer->Finish(&stream).ok() == false) {
+    throw std::runtime_error("Unable to finish the compression buffer");
+  }
+  auto frame = compressStream(*stream, codec);
+  std::cerr << "Compressed with " << codecName(codec) << ": "
+            << stream->size() << " -> " << frame->size() << " bytes"
+            << std::endl;
+  if (mStream->Write(frame->data(), frame->size()).ok() == false) {
+    throw std::runtime_error("Unable to write compressed table");
+  }
+  entry.length = frame->size();
+  entry.codec = codec;
+  if (mIndexed) {
+    mIndexed->addIndexEntry(std::move(entry));
+  }
+}
+
+void StreamTableSink::flush() { mStream->Flush(); }
+
+void StreamTableSink::close() {
+  auto status = mStream->Close();
+  if (status.ok() == false) {
+    throw std::runtime_error("Unable to close the output: " +
+                             status.ToString());
+  }
+}
+
+TableFilesSink::TableFilesSink(std::string const &directory)
+    : mDirectory{directory} {
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw std::runtime_error("Unable to create " + directory);
+  }
+}
+
+TableFilesSink::~TableFilesSink() {
+  if (mClosed == false) {
+    try {
+      close();
+    } catch (std::exception const &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+}
+
+void TableFilesSink::write(std::shared_ptr<arrow::Table> const &table) {
+  auto description = tableDescription(*table);
+  auto &tableFile = mFiles[description];
+  if (tableFile.writer == nullptr) {
+    tableFile.filename = description + ".arrow";
+    auto path = mDirectory + "/" + tableFile.filename;
+    if (arrow::io::FileOutputStream::Open(path, &tableFile.file).ok() ==
+            false ||
+        arrow::ipc::RecordBatchFileWriter::Open(
+            tableFile.file.get(), table->schema(), &tableFile.writer)
+                .ok() == false) {
+      throw std::runtime_error("Unable to open " + path);
+    }
+  }
+  std::cerr << "Writing table: " << description << " ... ";
+  arrow::TableBatchReader reader(*table);
+  std::shared_ptr<arrow::RecordBatch> batch;
+  while (true) {
+    if (reader.ReadNext(&batch).ok() == false) {
+      throw std::runtime_error("Error while processing " + description);
+    }
+    if (batch == nullptr) {
+      break;
+    }
+    if (tableFile.writer->WriteRecordBatch(*batch).ok() == false) {
+      throw std::runtime_error("Unable to write " + description);
+    }
+    tableFile.batchRows.push_back(batch->num_rows());
+  }
+  std::cerr << "[DONE]" << std::endl;
+}
+
+void TableFilesSink::close() {
+  mClosed = true;
+  std::ofstream manifest(mDirectory + "/manifest.json");
+  manifest << "{\n  \"tables\": [";
+  char const *separator = "\n";
+  for (auto &[description, tableFile] : mFiles) {
+    if (tableFile.writer->Close().ok() == false ||
+        tableFile.file->Close().ok() == false) {
+      throw std::runtime_error("Unable to close " + tableFile.filename);
+    }
+    int64_t rows = 0;
+    for (auto batchRows : tableFile.batchRows) {
+      rows += batchRows;
+    }
+    manifest << separator << "    {\"description\": \"" << description
+             << "\", \"file\": \"" << tableFile.filename
+             << "\", \"rows\": " << rows << ", \"batchRows\": [";
+    for (size_t bi = 0; bi < tableFile.batchRows.size(); ++bi) {
+      manifest << (bi ? ", " : "") << tableFile.batchRows[bi];
+    }
+    manifest << "]}";
+    separator = ",\n";
+  }
+  manifest << "\n  ]\n}\n";
+  if (!manifest) {
+    throw std::runtime_error("Unable to write " + mDirectory +
+                             "/manifest.json");
+  }
+}
+
+} // namespace o2::framework::run2
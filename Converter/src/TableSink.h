@@ -0,0 +1,95 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+#ifndef o2_framework_run2_TableSink_H_INCLUDED
+#define o2_framework_run2_TableSink_H_INCLUDED
+
+#include "AODCompression.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace arrow {
+class Table;
+namespace io {
+class OutputStream;
+class FileOutputStream;
+} // namespace io
+namespace ipc {
+class RecordBatchWriter;
+}
+} // namespace arrow
+
+namespace o2::framework::run2 {
+
+class MappedAODOutputStream;
+
+/// Where the converted tables end up. Tables are identified by the
+/// description in their schema metadata and the same table can be written
+/// several times (once per batch and per input file), in which case the
+/// pieces are meant to be concatenated by the readers.
+class TableSink {
+public:
+  virtual ~TableSink() = default;
+  virtual void write(std::shared_ptr<arrow::Table> const &table) = 0;
+  /// Called when a consistent set of tables has been written.
+  virtual void flush() {}
+  virtual void close() {}
+};
+
+/// Writes each table as a separate Arrow IPC stream, padded to 8 bytes, one
+/// after the other on the same output. Tables for which @a compression
+/// selects a codec are written as compressed frames (see AODCompression.h).
+/// When the output is a MappedAODOutputStream each stream is added to its
+/// index.
+class StreamTableSink : public TableSink {
+public:
+  explicit StreamTableSink(std::shared_ptr<arrow::io::OutputStream> stream,
+                           CompressionPolicy compression = {});
+  void write(std::shared_ptr<arrow::Table> const &table) override;
+  void flush() override;
+  void close() override;
+
+private:
+  std::shared_ptr<arrow::io::OutputStream> mStream;
+  /// mStream, if it is indexed.
+  std::shared_ptr<MappedAODOutputStream> mIndexed;
+  CompressionPolicy mCompression;
+};
+
+/// Writes one Arrow IPC file per table in a directory, e.g. TRACKPAR.arrow,
+/// each piece written being one or more record batches. Thanks to the file
+/// footer readers can go straight to any batch. On close() a manifest.json
+/// listing for each table its file and the rows of each of its batches is
+/// written next to them.
+class TableFilesSink : public TableSink {
+public:
+  explicit TableFilesSink(std::string const &directory);
+  ~TableFilesSink() override;
+  void write(std::shared_ptr<arrow::Table> const &table) override;
+  void close() override;
+
+private:
+  struct TableFile {
+    std::string filename;
+    std::shared_ptr<arrow::io::FileOutputStream> file;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+    std::vector<int64_t> batchRows;
+  };
+  std::string mDirectory;
+  std::map<std::string, TableFile> mFiles;
+  bool mClosed = false;
+};
+
+} // namespace o2::framework::run2
+
+#endif // o2_framework_run2_TableSink_H_INCLUDED
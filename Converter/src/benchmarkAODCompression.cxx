@@ -0,0 +1,154 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Reports, for each table of a converted AOD and for each available codec,
+// the compression ratio and the encoding / decoding throughput of the whole
+// table stream (what --compression does) and the compression ratio of each
+// of its columns, to help choosing a per table policy. Meant to be run on the
+// output of a reference ESD:
+//
+//   run2ESD2Run3AOD reference.root -o reference.arrow
+//   benchmarkAODCompression reference.arrow
+#include "AODCompression.h"
+#include "MappedAODFile.h"
+
+#include <arrow/buffer.h>
+#include <arrow/io/memory.h>
+#include <arrow/ipc/reader.h>
+#include <arrow/record_batch.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace o2::framework::run2;
+
+namespace {
+constexpr int repetitions = 5;
+constexpr double MB = 1 << 20;
+
+/// Codecs to try, skipping the ones this Arrow was built without.
+std::vector<arrow::Compression::type> availableCodecs() {
+  std::vector<arrow::Compression::type> codecs;
+  for (auto name : {"lz4", "zstd", "snappy", "gzip", "brotli"}) {
+    std::unique_ptr<arrow::util::Codec> codec;
+    auto type = parseCodec(name);
+    if (arrow::util::Codec::Create(type, &codec).ok()) {
+      codecs.push_back(type);
+    }
+  }
+  return codecs;
+}
+
+template <typename F> double bestSeconds(F &&f) {
+  double best = 0;
+  for (int ri = 0; ri < repetitions; ++ri) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    best = ri == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+void benchmarkStream(AODIndexEntry const &entry, arrow::Buffer const &stream,
+                     std::vector<arrow::Compression::type> const &codecs) {
+  for (auto codec : codecs) {
+    std::shared_ptr<arrow::Buffer> frame;
+    double encode =
+        bestSeconds([&]() { frame = compressStream(stream, codec); });
+    auto header = readFrameHeader(frame->data(), frame->size());
+    double decode = bestSeconds([&]() {
+      decompressFrame(header, frame->data() + compressedFrameHeaderSize);
+    });
+    printf("%-12s %-8s %10.2f %8.2f %10.1f %10.1f\n",
+           entry.description.c_str(), codecName(codec), stream.size() / MB,
+           double(stream.size()) / frame->size(), stream.size() / MB / encode,
+           stream.size() / MB / decode);
+  }
+}
+
+void benchmarkColumns(AODIndexEntry const &entry, arrow::Table const &table,
+                      std::vector<arrow::Compression::type> const &codecs) {
+  for (int ci = 0; ci < table.num_columns(); ++ci) {
+    printf("  %-24s", table.schema()->field(ci)->name().c_str());
+    for (auto codec : codecs) {
+      int64_t raw = 0;
+      int64_t compressed = 0;
+      for (auto &chunk : table.column(ci)->data()->chunks()) {
+        auto values = chunk->data()->buffers[1];
+        if (values == nullptr) {
+          continue;
+        }
+        auto frame = compressStream(*values, codec);
+        raw += values->size();
+        compressed += frame->size() - compressedFrameHeaderSize;
+      }
+      printf(" %s %6.2f", codecName(codec),
+             compressed ? double(raw) / compressed : 0.);
+    }
+    printf("\n");
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    puts("Usage: benchmarkAODCompression <file or shm:/name written with -o>");
+    return 1;
+  }
+  try {
+    auto data = mapAODFile(argv[1]);
+    auto index = readAODIndex(*data);
+    auto codecs = availableCodecs();
+
+    printf("%-12s %-8s %10s %8s %10s %10s\n", "table", "codec", "size (MB)",
+           "ratio", "enc (MB/s)", "dec (MB/s)");
+    for (auto &entry : index) {
+      auto stream = tableStream(data, entry);
+      benchmarkStream(entry, *stream, codecs);
+    }
+
+    printf("\nPer column compression ratios\n");
+    for (auto &entry : index) {
+      arrow::io::BufferReader input(tableStream(data, entry));
+      std::shared_ptr<arrow::RecordBatchReader> reader;
+      std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+      std::shared_ptr<arrow::RecordBatch> batch;
+      if (arrow::ipc::RecordBatchStreamReader::Open(&input, &reader).ok() ==
+          false) {
+        throw std::runtime_error("Unable to read " + entry.description);
+      }
+      while (reader->ReadNext(&batch).ok() && batch != nullptr) {
+        batches.push_back(batch);
+      }
+      std::shared_ptr<arrow::Table> table;
+      if (arrow::Table::FromRecordBatches(reader->schema(), batches, &table)
+              .ok() == false) {
+        throw std::runtime_error("Unable to read " + entry.description);
+      }
+      printf("%s\n", entry.description.c_str());
+      benchmarkColumns(entry, *table, codecs);
+    }
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
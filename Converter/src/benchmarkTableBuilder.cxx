@@ -0,0 +1,98 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Compares the rows per second at which TRACKPAR can be filled through
+// TableBuilder::cursor(), TableBuilder::preallocatedCursor() and
+// TypedTableBuilder, including the creation of the final arrow::Table:
+//
+//   benchmarkTableBuilder [rows]
+#include "Framework/AnalysisDataModel.h"
+#include "Framework/TableBuilder.h"
+
+#include <arrow/table.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+using namespace o2;
+using namespace o2::framework;
+
+namespace {
+constexpr int repetitions = 5;
+
+template <typename F> double bestSeconds(F &&f) {
+  double best = 0;
+  for (int ri = 0; ri < repetitions; ++ri) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    best = ri == 0 ? seconds : std::min(best, seconds);
+  }
+  return best;
+}
+
+/// Fills @a nRows made up track rows through @a filler, which has the
+/// signature of the TableBuilder cursors.
+template <typename FILLER> void fillTracks(FILLER &&filler, int64_t nRows) {
+  for (int64_t ri = 0; ri < nRows; ++ri) {
+    float const f = ri;
+    filler(0, static_cast<int>(ri >> 10), f, 0.1f * f, 0.2f * f, 0.3f * f,
+           0.4f * f, 0.5f * f, 0.6f * f);
+  }
+}
+
+void report(char const *name, int64_t nRows, double seconds,
+            std::shared_ptr<arrow::Table> const &table) {
+  if (table->num_rows() != nRows) {
+    throw std::runtime_error(std::string(name) + " filled " +
+                             std::to_string(table->num_rows()) + " rows");
+  }
+  printf("%-20s %10.3f s %12.3g rows/s\n", name, seconds, nRows / seconds);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  int64_t const nRows = argc > 1 ? std::atol(argv[1]) : 10000000;
+  try {
+    std::shared_ptr<arrow::Table> table;
+    double seconds = bestSeconds([&]() {
+      TableBuilder builder;
+      fillTracks(builder.cursor<aod::Tracks>(), nRows);
+      table = builder.finalize();
+    });
+    report("cursor", nRows, seconds, table);
+
+    seconds = bestSeconds([&]() {
+      TableBuilder builder;
+      fillTracks(builder.preallocatedCursor<aod::Tracks>(nRows), nRows);
+      table = builder.finalize();
+    });
+    report("preallocatedCursor", nRows, seconds, table);
+
+    seconds = bestSeconds([&]() {
+      TypedTableBuilder<aod::Tracks> builder;
+      fillTracks(builder.cursor(), nRows);
+      table = builder.finalize();
+    });
+    report("TypedTableBuilder", nRows, seconds, table);
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
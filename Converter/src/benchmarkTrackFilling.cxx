@@ -0,0 +1,102 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Converts the track tables (TRACKPAR, TRACKPARCOV and TRACKEXTRA) of an ESD
+// file, preferably a Pb-Pb one, filling them either one row at a time or
+// through the per event staging arrays, and reports the time and tracks per
+// second of both. Tables are discarded rather than written out:
+//
+//   benchmarkTrackFilling AliESDs.root [events]
+#include "Run3AODConverter.h"
+#include "TableSink.h"
+
+#include <arrow/table.h>
+
+#include <TFile.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace o2::framework::run2;
+
+namespace {
+constexpr int repetitions = 3;
+
+/// Counts the rows written to it and drops them.
+class CountingTableSink : public TableSink {
+public:
+  void write(std::shared_ptr<arrow::Table> const &table) override {
+    rows += table->num_rows();
+  }
+  int64_t rows = 0;
+};
+
+/// Best time over a few conversions of @a tree with @a options, the first
+/// conversion (which also warms up the file cache) not being counted.
+double bestSeconds(TTree *tree, Run3AODConverter::Options const &options,
+                   int64_t &rows) {
+  double best = 0;
+  for (int ri = 0; ri <= repetitions; ++ri) {
+    CountingTableSink sink;
+    auto start = std::chrono::steady_clock::now();
+    Run3AODConverter::convert(tree, sink, options);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    rows = sink.rows;
+    if (ri == 1 || (ri > 1 && seconds < best)) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    puts("Usage: benchmarkTrackFilling <AliESDs.root> [events]");
+    return 1;
+  }
+  try {
+    std::unique_ptr<TFile> file(TFile::Open(argv[1]));
+    if (!file || file->IsZombie()) {
+      throw std::runtime_error(std::string("Unable to open ") + argv[1]);
+    }
+    auto tree = (TTree *)file->Get("esdTree");
+    if (tree == nullptr) {
+      throw std::runtime_error("Unable to find esdTree");
+    }
+    Run3AODConverter::Options options;
+    options.nEvents = argc > 2 ? std::atol(argv[2]) : 0;
+    options.tables = {"TRACKPAR", "TRACKPARCOV", "TRACKEXTRA"};
+
+    printf("%-12s %10s %14s\n", "filling", "seconds", "tracks/s");
+    for (bool rowWise : {true, false}) {
+      options.rowWiseTracks = rowWise;
+      int64_t rows = 0;
+      double seconds = bestSeconds(tree, options, rows);
+      // Each track is a row of each of the three tables.
+      printf("%-12s %10.3f %14.4g\n", rowWise ? "row wise" : "staged",
+             seconds, rows / 3 / seconds);
+    }
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,3 +1,6 @@
+#include "ConversionPipeline.h"
+#include "MappedAODFile.h"
+#include "TableSink.h"
 #include "Run3AODConverter.h"
 
 #include <arrow/io/buffered.h>
@@ -8,6 +11,7 @@
 #include <TEnv.h>
 #include <TError.h>
 #include <TFile.h>
+#include <TROOT.h>
 #include <TTree.h>
 #include <algorithm>
 #include <cstdio>
@@ -15,6 +19,7 @@
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -22,6 +27,15 @@ int main(int argc, char **argv) {
   if (argc < 2) {
     puts("Please specify one or more ROOT file or a list of files preceded by "
          ".txt");
+    puts("Options: -n <events> -j <conversion threads> "
+         "--batch-events <events per batch> "
+         "--tables <TRACKPAR,TRACKPARCOV,...> "
+         "--direct-read <TRACKPAR,TRACKPARCOV> --verify-direct-read "
+         "--cache-size <MB> --unzip-threads <threads> --io-report "
+         "--reduce-precision --collision-ranges --filter '<expression>' "
+         "--arena-memory-pool --memory-report "
+         "-o <file or shm:/name> --output-dir <directory> "
+         "--compression <TRACKPARCOV=zstd,TRACKPAR=none,lz4>");
     exit(1);
   }
   std::vector<std::string> arguments;
@@ -30,18 +44,130 @@ int main(int argc, char **argv) {
     arguments.push_back(s);
   }
 
-  size_t nEvents = 0;
+  o2::framework::run2::Run3AODConverter::Options options;
   auto pos = std::find(arguments.begin(), arguments.end(), "-n");
   if (pos != arguments.end()) {
     pos++;
     if (pos->empty() == false) {
-      nEvents = std::stol(*pos);
-      std::cerr << "Events to process: " << nEvents << std::endl;
+      options.nEvents = std::stol(*pos);
+      std::cerr << "Events to process: " << options.nEvents << std::endl;
     } else {
       std::cerr << "Event number not set, using all." << std::endl;
     }
   }
 
+  pos = std::find(arguments.begin(), arguments.end(), "-j");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    options.nThreads = std::max(1l, std::stol(*pos));
+    std::cerr << "Conversion threads: " << options.nThreads << std::endl;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--batch-events");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    options.batchEvents = std::stol(*pos);
+    std::cerr << "Events per batch: " << options.batchEvents << std::endl;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--tables");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    std::stringstream tables(*pos);
+    std::string table;
+    while (std::getline(tables, table, ',')) {
+      options.tables.insert(table);
+    }
+    std::cerr << "Tables to produce: " << *pos << std::endl;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--direct-read");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    std::stringstream tables(*pos);
+    std::string table;
+    while (std::getline(tables, table, ',')) {
+      options.directRead.insert(table);
+    }
+    std::cerr << "Tables read directly: " << *pos << std::endl;
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--verify-direct-read") !=
+      arguments.end()) {
+    options.verifyDirectRead = true;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--cache-size");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    options.cacheSize = std::stol(*pos) << 20;
+    std::cerr << "TTreeCache size: " << *pos << " MB" << std::endl;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--unzip-threads");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    options.unzipThreads = std::stol(*pos);
+    std::cerr << "Decompression threads: " << options.unzipThreads
+              << std::endl;
+    ROOT::EnableImplicitMT(options.unzipThreads);
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--io-report") !=
+      arguments.end()) {
+    options.ioReport = true;
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--reduce-precision") !=
+      arguments.end()) {
+    options.reducePrecision = true;
+    std::cerr << "Reducing float columns to the ESD precision" << std::endl;
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--collision-ranges") !=
+      arguments.end()) {
+    options.collisionRanges = true;
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--arena-memory-pool") !=
+      arguments.end()) {
+    options.arenaMemoryPool = true;
+  }
+
+  if (std::find(arguments.begin(), arguments.end(), "--memory-report") !=
+      arguments.end()) {
+    options.memoryReport = true;
+  }
+
+  pos = std::find(arguments.begin(), arguments.end(), "--filter");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    options.filter = *pos;
+    std::cerr << "Filter: " << options.filter << std::endl;
+  }
+
+  std::string outputTarget;
+  pos = std::find(arguments.begin(), arguments.end(), "-o");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    outputTarget = *pos;
+    std::cerr << "Output: " << outputTarget << std::endl;
+  }
+
+  std::string outputDirectory;
+  pos = std::find(arguments.begin(), arguments.end(), "--output-dir");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    outputDirectory = *pos;
+    std::cerr << "Output directory: " << outputDirectory << std::endl;
+  }
+  if (outputTarget.empty() == false && outputDirectory.empty() == false) {
+    puts("-o and --output-dir are mutually exclusive");
+    exit(1);
+  }
+
+  std::string compression;
+  pos = std::find(arguments.begin(), arguments.end(), "--compression");
+  if (pos != arguments.end() && ++pos != arguments.end()) {
+    compression = *pos;
+    std::cerr << "Compression: " << compression << std::endl;
+  }
+  if (compression.empty() == false && outputDirectory.empty() == false) {
+    puts("--compression is only supported for stream outputs");
+    exit(1);
+  }
+
   auto NotAROOTFileName = [](std::string const &input) {
     std::regex isROOTfile(R"(.*\.root$)");
     std::smatch match;
@@ -55,16 +181,25 @@ int main(int argc, char **argv) {
   gErrorIgnoreLevel = kError;
   gEnv->SetValue("AliRoot.AliLog.Output", "error");
 
-  for (auto &filename : arguments) {
-    auto infile = std::make_unique<TFile>(filename.c_str());
-    TTree *tEsd = (TTree *)infile->Get("esdTree");
+  std::unique_ptr<o2::framework::run2::TableSink> sink;
+  if (outputDirectory.empty() == false) {
+    sink = std::make_unique<o2::framework::run2::TableFilesSink>(
+        outputDirectory);
+  } else if (outputTarget.empty() == false) {
+    sink = std::make_unique<o2::framework::run2::StreamTableSink>(
+        o2::framework::run2::MappedAODOutputStream::open(outputTarget),
+        o2::framework::run2::CompressionPolicy(compression));
+  } else {
     std::shared_ptr<arrow::io::OutputStream> rawStream(
         new arrow::io::StdoutStream);
     std::shared_ptr<arrow::io::BufferedOutputStream> stream;
     arrow::io::BufferedOutputStream::Create(
         1000000, arrow::default_memory_pool(), rawStream, &stream);
-    o2::framework::run2::Run3AODConverter::convert(tEsd, stream, nEvents);
-    stream->Close();
+    sink = std::make_unique<o2::framework::run2::StreamTableSink>(
+        stream, o2::framework::run2::CompressionPolicy(compression));
   }
+  auto timings = o2::framework::run2::convertFiles(arguments, options, *sink);
+  sink->close();
+  timings.print(std::cerr);
   return 0;
 }
@@ -0,0 +1,83 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Checks that TypedTableBuilder keeps every row when reserve() is called
+// after some rows were already filled, i.e. while part of an earlier
+// reservation is still free. Returns non zero on failure.
+#include "Framework/AnalysisDataModel.h"
+#include "Framework/TableBuilder.h"
+
+#include <arrow/array.h>
+#include <arrow/table.h>
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+using namespace o2;
+using namespace o2::framework;
+
+namespace {
+void fillTracks(TypedTableBuilder<aod::Tracks> &builder, int64_t first,
+                int64_t nRows) {
+  for (int64_t ri = first; ri < first + nRows; ++ri) {
+    float const f = ri;
+    builder.fill(static_cast<int>(ri), f, f, f, f, f, f, f);
+  }
+}
+
+/// Whether column @a ci of @a table holds 0, 1, ..., nRows - 1.
+template <typename ARRAY>
+bool checkColumn(arrow::Table const &table, int ci, int64_t nRows) {
+  int64_t expected = 0;
+  for (auto &chunk : table.column(ci)->data()->chunks()) {
+    auto values = std::static_pointer_cast<ARRAY>(chunk);
+    for (int64_t ri = 0; ri < values->length(); ++ri, ++expected) {
+      if (values->Value(ri) != expected) {
+        return false;
+      }
+    }
+  }
+  return expected == nRows;
+}
+} // namespace
+
+int main() {
+  try {
+    // The first fill() reserves 4 rows, 1 is still free when reserve() adds
+    // room for 10 more, all of which are then used, and more.
+    TypedTableBuilder<aod::Tracks> builder(4);
+    fillTracks(builder, 0, 3);
+    builder.reserve(10);
+    fillTracks(builder, 3, 11);
+    builder.reserve(2);
+    fillTracks(builder, 14, 9);
+    int64_t const nRows = 23;
+
+    auto table = builder.finalize();
+    if (table->num_rows() != nRows) {
+      std::cerr << "Expected " << nRows << " rows, got " << table->num_rows()
+                << std::endl;
+      return 1;
+    }
+    if (checkColumn<arrow::Int32Array>(*table, 0, nRows) == false ||
+        checkColumn<arrow::FloatArray>(*table, 1, nRows) == false ||
+        checkColumn<arrow::FloatArray>(*table, 7, nRows) == false) {
+      std::cerr << "Unexpected values in the table" << std::endl;
+      return 1;
+    }
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,152 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// Compares the float columns of two conversions of the same input, one of
+// them done with --reduce-precision, and reports the maximum absolute and
+// relative differences per column:
+//
+//   run2ESD2Run3AOD AliESDs.root -o full.arrow
+//   run2ESD2Run3AOD AliESDs.root -o reduced.arrow --reduce-precision
+//   validateAODPrecision full.arrow reduced.arrow
+#include "MappedAODFile.h"
+
+#include <arrow/array.h>
+#include <arrow/buffer.h>
+#include <arrow/io/memory.h>
+#include <arrow/ipc/reader.h>
+#include <arrow/record_batch.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace o2::framework::run2;
+
+namespace {
+/// All the streams of the mapped file @a source, concatenated per table.
+std::map<std::string, std::shared_ptr<arrow::Table>>
+readTables(char const *source) {
+  auto data = mapAODFile(source);
+  std::map<std::string, std::vector<std::shared_ptr<arrow::RecordBatch>>>
+      batches;
+  std::map<std::string, std::shared_ptr<arrow::Schema>> schemas;
+  for (auto &entry : readAODIndex(*data)) {
+    arrow::io::BufferReader input(tableStream(data, entry));
+    std::shared_ptr<arrow::RecordBatchReader> reader;
+    if (arrow::ipc::RecordBatchStreamReader::Open(&input, &reader).ok() ==
+        false) {
+      throw std::runtime_error("Unable to read " + entry.description);
+    }
+    std::shared_ptr<arrow::RecordBatch> batch;
+    while (reader->ReadNext(&batch).ok() && batch != nullptr) {
+      batches[entry.description].push_back(batch);
+    }
+    schemas[entry.description] = reader->schema();
+  }
+  std::map<std::string, std::shared_ptr<arrow::Table>> tables;
+  for (auto &[description, schema] : schemas) {
+    if (arrow::Table::FromRecordBatches(schema, batches[description],
+                                        &tables[description])
+            .ok() == false) {
+      throw std::runtime_error("Unable to read " + description);
+    }
+  }
+  return tables;
+}
+
+std::vector<float> floatValues(arrow::ChunkedArray const &column) {
+  std::vector<float> values;
+  values.reserve(column.length());
+  for (auto &chunk : column.chunks()) {
+    auto floats = std::static_pointer_cast<arrow::FloatArray>(chunk);
+    values.insert(values.end(), floats->raw_values(),
+                  floats->raw_values() + floats->length());
+  }
+  return values;
+}
+
+/// Returns the number of columns which differ in anything but precision.
+int compareTables(std::string const &description, arrow::Table const &full,
+                  arrow::Table const &reduced) {
+  if (full.num_rows() != reduced.num_rows() ||
+      full.schema()->Equals(*reduced.schema(), false) == false) {
+    printf("%-12s different rows or columns\n", description.c_str());
+    return 1;
+  }
+  int mismatches = 0;
+  for (int ci = 0; ci < full.num_columns(); ++ci) {
+    auto field = full.schema()->field(ci);
+    if (field->type()->id() != arrow::Type::FLOAT) {
+      if (full.column(ci)->data()->Equals(reduced.column(ci)->data()) ==
+          false) {
+        printf("%-12s %-24s differs\n", description.c_str(),
+               field->name().c_str());
+        ++mismatches;
+      }
+      continue;
+    }
+    auto a = floatValues(*full.column(ci)->data());
+    auto b = floatValues(*reduced.column(ci)->data());
+    double maxAbsolute = 0;
+    double maxRelative = 0;
+    size_t changed = 0;
+    for (size_t ri = 0; ri < a.size(); ++ri) {
+      if (a[ri] == b[ri] || (std::isnan(a[ri]) && std::isnan(b[ri]))) {
+        continue;
+      }
+      ++changed;
+      double delta = std::fabs(double(a[ri]) - b[ri]);
+      maxAbsolute = std::max(maxAbsolute, delta);
+      if (a[ri] != 0) {
+        maxRelative = std::max(maxRelative, delta / std::fabs(a[ri]));
+      }
+    }
+    printf("%-12s %-24s %10zu %12.4g %12.4g\n", description.c_str(),
+           field->name().c_str(), changed, maxAbsolute, maxRelative);
+  }
+  return mismatches;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    puts("Usage: validateAODPrecision <full precision output> "
+         "<--reduce-precision output>");
+    return 1;
+  }
+  int mismatches = 0;
+  try {
+    auto full = readTables(argv[1]);
+    auto reduced = readTables(argv[2]);
+    printf("%-12s %-24s %10s %12s %12s\n", "table", "column", "changed",
+           "max abs", "max rel");
+    for (auto &[description, table] : full) {
+      auto it = reduced.find(description);
+      if (it == reduced.end()) {
+        printf("%-12s missing\n", description.c_str());
+        ++mismatches;
+        continue;
+      }
+      mismatches += compareTables(description, *table, *it->second);
+    }
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return mismatches == 0 ? 0 : 1;
+}
@@ -1,4 +1,10 @@
+#include "AODCompression.h"
+#include "MappedAODFile.h"
+
+#include <arrow/buffer.h>
 #include <arrow/io/buffered.h>
+#include <arrow/io/file.h>
+#include <arrow/io/memory.h>
 #include <arrow/ipc/reader.h>
 #include <arrow/ipc/writer.h>
 #include <arrow/memory_pool.h>
@@ -6,17 +12,138 @@
 #include <arrow/type.h>
 #include <arrow/util/io-util.h>
 #include <arrow/util/key_value_metadata.h>
+#include <arrow/util/string_view.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include <cstdio>
 #include <cstdlib>
+#include <exception>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 using namespace arrow;
 using namespace arrow::io;
 using namespace arrow::ipc;
 
+/// Prints the batches of the Arrow stream read from @a stream, adding up their
+/// rows in @a rows.
+int printBatches(InputStream *stream, int64_t *rows) {
+  std::shared_ptr<RecordBatchReader> reader;
+  auto status = RecordBatchStreamReader::Open(stream, &reader);
+  if (status.ok() == false) {
+    std::cerr << "Unable to open stream for read " << status << std::endl;
+    return 1;
+  }
+  std::shared_ptr<RecordBatch> batch;
+  while (true) {
+    if (reader->ReadNext(&batch).ok() == false) {
+      puts("Unable to read batch\n");
+      return 1;
+    }
+    if (batch == nullptr) {
+      break;
+    }
+    std::unordered_map<std::string, std::string> meta;
+    batch->schema()->metadata()->ToUnorderedMap(&meta);
+    printf("table: %s\n", meta["description"].c_str());
+    printf("  num_columns: %d, num_rows: %lld\n", batch->num_columns(),
+           batch->num_rows());
+    *rows += batch->num_rows();
+  }
+  return 0;
+}
+
+/// Validates a file written with run2ESD2Run3AOD -o, going through its index
+/// and reading each table straight from the mapping.
+int validateMappedFile(std::string const &source) {
+  std::shared_ptr<Buffer> data;
+  std::vector<o2::framework::run2::AODIndexEntry> index;
+  try {
+    data = o2::framework::run2::mapAODFile(source);
+    index = o2::framework::run2::readAODIndex(*data);
+  } catch (std::exception const &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  for (auto &entry : index) {
+    printf("Stream position: %lld\n", entry.offset);
+    int64_t rows = 0;
+    try {
+      BufferReader stream(o2::framework::run2::tableStream(data, entry));
+      if (printBatches(&stream, &rows) != 0) {
+        return 1;
+      }
+    } catch (std::exception const &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    if (rows != entry.rows) {
+      std::cerr << "Index says " << entry.rows << " rows for "
+                << entry.description << ", found " << rows << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/// Validates a directory written with run2ESD2Run3AOD --output-dir, reading
+/// each record batch of each table file through the file footer.
+int validateTableFiles(std::string const &directory) {
+  DIR *dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    std::cerr << "Unable to open " << directory << std::endl;
+    return 1;
+  }
+  std::vector<std::string> filenames;
+  while (auto entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name.size() > 6 && name.compare(name.size() - 6, 6, ".arrow") == 0) {
+      filenames.push_back(directory + "/" + name);
+    }
+  }
+  closedir(dir);
+  for (auto &filename : filenames) {
+    std::shared_ptr<ReadableFile> file;
+    std::shared_ptr<RecordBatchFileReader> reader;
+    auto status = ReadableFile::Open(filename, &file);
+    if (status.ok()) {
+      status = RecordBatchFileReader::Open(file.get(), &reader);
+    }
+    if (status.ok() == false) {
+      std::cerr << "Unable to open " << filename << " " << status
+                << std::endl;
+      return 1;
+    }
+    std::unordered_map<std::string, std::string> meta;
+    reader->schema()->metadata()->ToUnorderedMap(&meta);
+    printf("table: %s, %d batches\n", meta["description"].c_str(),
+           reader->num_record_batches());
+    for (int bi = 0; bi < reader->num_record_batches(); ++bi) {
+      std::shared_ptr<RecordBatch> batch;
+      if (reader->ReadRecordBatch(bi, &batch).ok() == false) {
+        printf("Unable to read batch %d\n", bi);
+        return 1;
+      }
+      printf("  num_columns: %d, num_rows: %lld\n", batch->num_columns(),
+             batch->num_rows());
+    }
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
+  // Without arguments the concatenated streams are read from stdin.
+  if (argc > 1) {
+    struct stat info;
+    if (stat(argv[1], &info) == 0 && S_ISDIR(info.st_mode)) {
+      return validateTableFiles(argv[1]);
+    }
+    return validateMappedFile(argv[1]);
+  }
   std::shared_ptr<InputStream> rawStream(new StdinStream);
   std::shared_ptr<BufferedInputStream> stream;
   auto bufferStatus = BufferedInputStream::Create(
@@ -31,6 +158,27 @@ int main(int argc, char **argv) {
     int64_t pos;
     stream->Tell(&pos);
     printf("Stream position: %lld\n", pos);
+    // Compressed tables come as a frame holding the whole stream.
+    util::string_view head;
+    stream->Peek(o2::framework::run2::compressedFrameHeaderSize, &head);
+    auto headData = reinterpret_cast<uint8_t const *>(head.data());
+    if (o2::framework::run2::isCompressedFrame(headData, head.size())) {
+      auto header = o2::framework::run2::readFrameHeader(headData, head.size());
+      std::shared_ptr<Buffer> frame;
+      status = stream->Read(header.frameSize(), &frame);
+      if (status.ok() == false || frame->size() != header.frameSize()) {
+        puts("Unable to read compressed frame\n");
+        return 1;
+      }
+      BufferReader frameStream(o2::framework::run2::decompressFrame(
+          header,
+          frame->data() + o2::framework::run2::compressedFrameHeaderSize));
+      int64_t rows = 0;
+      if (printBatches(&frameStream, &rows) != 0) {
+        return 1;
+      }
+      continue;
+    }
     std::shared_ptr<RecordBatchReader> reader;
     status = RecordBatchStreamReader::Open(stream.get(), &reader);
     if (status.ok() == false) {
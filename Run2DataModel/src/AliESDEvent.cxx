@@ -173,6 +173,7 @@ AliESDEvent::AliESDEvent():
   fConnected(kFALSE),
   fUseOwnList(kFALSE),
   fTracksConnected(kFALSE),
+  fResetActions(),
   fTOFHeader(0),
   fCentrality(0),
   fEventplane(0),
@@ -233,6 +234,7 @@ AliESDEvent::AliESDEvent(const AliESDEvent& esd):
   fConnected(esd.fConnected),
   fUseOwnList(esd.fUseOwnList),
   fTracksConnected(kFALSE),
+  fResetActions(),
   fTOFHeader(new AliTOFHeader(*esd.fTOFHeader)),
   fCentrality(new AliCentrality(*esd.fCentrality)),
   fEventplane(new AliEventplane(*esd.fEventplane)),
@@ -393,6 +395,7 @@ AliESDEvent & AliESDEvent::operator=(const AliESDEvent& source) {
 
   fNTPCFriend2Store = source.fNTPCFriend2Store;
   fTracksConnected = kFALSE;
+  fResetActions.Set(0);
   ConnectTracks();
   return *this;
 }
@@ -457,39 +460,79 @@ void AliESDEvent::Reset()
   if(fESDObjects->GetSize()>kESDListN){
     // we have non std content
     // this also covers esdfriends
+    // the way to reset each object is looked up once per tree, not per event
+    if(fResetActions.GetSize()!=fESDObjects->GetSize()-kESDListN)CacheResetActions();
     for(int i = kESDListN;i < fESDObjects->GetSize();++i){
       TObject *pObject = fESDObjects->At(i);
-      // TClonesArrays
-      if(pObject->InheritsFrom(TClonesArray::Class())){
+      switch(fResetActions[i-kESDListN]){
+      case kResetDelete:
 	((TClonesArray*)pObject)->Delete();
-      }
-      else if(!pObject->InheritsFrom(TCollection::Class())){
-	TClass *pClass = TClass::GetClass(pObject->ClassName());
-	if (pClass && pClass->GetListOfMethods()->FindObject("Clear")) {
-	  AliDebug(1, Form("Clear for object %s class %s", pObject->GetName(), pObject->ClassName()));
-	  pObject->Clear();
-	}
-	else {
-	  AliDebug(1, Form("ResetWithPlacementNew for object %s class %s", pObject->GetName(), pObject->ClassName()));
-	  ResetWithPlacementNew(pObject);
-	}
-      }
-      else{
-	AliWarning(Form("No reset for %s \n",
-			pObject->ClassName()));
+	break;
+      case kResetClearSlots:
+	// keeps the elements allocated, they are reused by the next event
+	((TClonesArray*)pObject)->Clear("C");
+	break;
+      case kResetClear:
+	pObject->Clear();
+	break;
+      case kResetPlacementNew:
+	ResetWithPlacementNew(pObject);
+	break;
+      default:
+	break;
       }
     }
   }
 
 }
 
+//______________________________________________________________________________
+UChar_t AliESDEvent::ResetActionFor(TObject *pObject){
+  //
+  // how to reset pObject between events:
+  // TClonesArrays of a class implementing Clear are cleared with option "C",
+  // which keeps their slots for the next event, the other ones are deleted.
+  // Objects implementing Clear are cleared, the others are recreated in place
+  //
+  if(pObject->InheritsFrom(TClonesArray::Class())){
+    TClass *pClass = ((TClonesArray*)pObject)->GetClass();
+    if (pClass && pClass->GetListOfMethods()->FindObject("Clear")) return kResetClearSlots;
+    return kResetDelete;
+  }
+  if(pObject->InheritsFrom(TCollection::Class())){
+    AliWarningClass(Form("No reset for %s \n",
+			 pObject->ClassName()));
+    return kResetNone;
+  }
+  TClass *pClass = TClass::GetClass(pObject->ClassName());
+  if (pClass && pClass->GetListOfMethods()->FindObject("Clear")) {
+    AliDebugClass(1, Form("Clear for object %s class %s", pObject->GetName(), pObject->ClassName()));
+    return kResetClear;
+  }
+  AliDebugClass(1, Form("ResetWithPlacementNew for object %s class %s", pObject->GetName(), pObject->ClassName()));
+  return kResetPlacementNew;
+}
+
+//______________________________________________________________________________
+void AliESDEvent::CacheResetActions(){
+  //
+  // look up once how Reset() handles each of the non std objects, instead
+  // of going through the dictionary of their classes for each event
+  //
+  Int_t n = fESDObjects->GetSize()-kESDListN;
+  fResetActions.Set(n>0 ? n : 0);
+  for(int i = 0;i < n;++i){
+    fResetActions[i] = ResetActionFor(fESDObjects->At(kESDListN+i));
+  }
+}
+
 //______________________________________________________________________________
 Bool_t AliESDEvent::ResetWithPlacementNew(TObject *pObject){
   //
   // funtion to reset using the already allocated space
   //
   Long_t dtoronly = TObject::GetDtorOnly();
-  TClass *pClass = TClass::GetClass(pObject->ClassName()); 
+  TClass *pClass = pObject->IsA(); 
   TObject::SetDtorOnly(pObject);
   delete pObject;
   // Recreate with placement new
@@ -575,7 +618,7 @@ void AliESDEvent::ResetStdContent()
   if(fV0s)fV0s->Clear();
   if(fCascades)fCascades->Delete();
   if(fKinks)fKinks->Delete();
-  if(fCaloClusters)fCaloClusters->Delete();
+  if(fCaloClusters)fCaloClusters->Clear("C"); // AliESDCaloCluster::Clear releases its arrays
   if(fPHOSCells)fPHOSCells->DeleteContainer();
   if(fEMCALCells)fEMCALCells->DeleteContainer();
   if(fCosmicTracks)fCosmicTracks->Delete();
@@ -1673,6 +1716,7 @@ void AliESDEvent::AddObject(TObject* obj)
   // refrain from using TObjArrays (if possible). Use TClonesArrays, instead.
   fESDObjects->SetOwner(kTRUE);
   fESDObjects->AddLast(obj);
+  fResetActions.Set(0);
 }
 
 //______________________________________________________________________________
@@ -1925,6 +1969,8 @@ void AliESDEvent::ReadFromTree(TTree *tree, Option_t* opt){
     AliWarning("AliESDEvent::ReadFromTree() Zero Pointer to Tree \n");
     return;
   }
+  // the list of objects may change, reset actions are looked up again
+  fResetActions.Set(0);
   // load the TTree
   if(!tree->GetTree())tree->LoadTree(0);
 
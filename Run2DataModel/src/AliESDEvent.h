@@ -19,6 +19,7 @@
 #include <TObject.h>
 #include <TTree.h>
 #include <TArrayF.h>
+#include <TArrayC.h>
 #include <TObjArray.h>
 
 
@@ -615,6 +616,11 @@ public:
 protected:
   AliESDEvent(const AliESDEvent&);
   static Bool_t ResetWithPlacementNew(TObject *pObject);
+  static UChar_t ResetActionFor(TObject *pObject);
+  void CacheResetActions();
+
+  // how Reset() brings back each of the non std objects
+  enum EResetAction {kResetNone, kResetDelete, kResetClearSlots, kResetClear, kResetPlacementNew};
 
   void AddMuonTrack(const AliESDMuonTrack *t);
   void AddMuonGlobalTrack(const AliESDMuonGlobalTrack *t);     // AU
@@ -667,6 +673,7 @@ protected:
   Bool_t    fConnected;            //! flag if leaves are alreday connected
   Bool_t    fUseOwnList;           //! Do not use the list from the esdTree but use the one created by this class 
   Bool_t    fTracksConnected;      //! flag if tracks have already pointer to event set
+  TArrayC   fResetActions;         //! EResetAction of each non std object, see CacheResetActions()
   static const char* fgkESDListName[kESDListN]; //!
 
   AliTOFHeader *fTOFHeader;  //! event times (and sigmas) as estimated by TOF
@@ -109,6 +109,18 @@ if (ARROW_FOUND)
             INTERFACE_LINK_LIBRARIES "${ARROW_LIB_PATH}"
             )
   endif()
+  # gandiva, used to evaluate filter expressions, is installed next to arrow
+  get_filename_component(ARROW_LIB_DIR "${ARROW_LIB_PATH}" DIRECTORY)
+  find_library(GANDIVA_LIB_PATH NAMES gandiva
+    PATHS ${ARROW_LIB_DIR} ${ARROW_SEARCH_LIB_PATH}
+    NO_DEFAULT_PATH)
+  if(GANDIVA_LIB_PATH AND NOT TARGET Arrow::Gandiva)
+    add_library(Arrow::Gandiva INTERFACE IMPORTED)
+    set_target_properties(Arrow::Gandiva PROPERTIES
+            INTERFACE_INCLUDE_DIRECTORIES "${ARROW_INCLUDE_DIR}"
+            INTERFACE_LINK_LIBRARIES "${GANDIVA_LIB_PATH};${ARROW_LIB_PATH}"
+            )
+  endif()
 else()
   if (NOT Arrow_FIND_QUIETLY)
     set(ARROW_ERR_MSG "Could not find the Arrow library. Looked for headers")
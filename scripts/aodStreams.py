@@ -0,0 +1,56 @@
+#!/usr/bin/env python
+# Reads the tables written by run2ESD2Run3AOD, either to stdout or to a
+# memory mapped file (-o), unwrapping the compressed frames produced by
+# --compression (see Converter/src/AODCompression.h). Those frames are not
+# Arrow streams, hence standard Arrow readers cannot open them directly.
+import struct
+
+import pyarrow as pa
+
+FRAME_MAGIC = b'AODZ'
+FRAME_HEADER = struct.Struct('<4siqq')
+INDEX_MAGIC = b'AODINDX1'
+
+# arrow::Compression::type of the Arrow version the converter is built with
+CODECS = {1: 'snappy', 2: 'gzip', 3: 'brotli', 4: 'zstd', 5: 'lz4'}
+
+
+def unwrap(data, offset=0):
+  """Returns the Arrow stream starting at offset in data, a memoryview,
+  decompressing it if it is a compressed frame, and the size of the frame
+  (0 for a plain stream, whose size is only known once it has been read)."""
+  if data[offset:offset + 4].tobytes() != FRAME_MAGIC:
+    return pa.py_buffer(data[offset:]), 0
+  if len(data) - offset < FRAME_HEADER.size:
+    raise ValueError('Truncated compressed AOD frame at offset %d' % offset)
+  _, codec, compressed, uncompressed = FRAME_HEADER.unpack_from(data, offset)
+  if codec not in CODECS:
+    raise ValueError('Unsupported codec %d in compressed AOD frame at '
+                     'offset %d' % (codec, offset))
+  begin = offset + FRAME_HEADER.size
+  if compressed < 0 or begin + compressed > len(data):
+    raise ValueError('Truncated compressed AOD frame at offset %d' % offset)
+  stream = pa.decompress(pa.py_buffer(data[begin:begin + compressed]),
+                         decompressed_size=uncompressed, codec=CODECS[codec])
+  return stream, (FRAME_HEADER.size + compressed + 7) // 8 * 8
+
+
+def read_tables(data):
+  """Yields the tables in data, the content of a run2ESD2Run3AOD output, in
+  the order they were written. The same table can come several times, e.g.
+  once per batch with --batch-events."""
+  end = len(data)
+  if data[-len(INDEX_MAGIC):] == INDEX_MAGIC:
+    # Indexed file written with -o: streams stop where the index starts.
+    index_size, = struct.unpack_from('<q', data, end - len(INDEX_MAGIC) - 8)
+    end -= len(INDEX_MAGIC) + index_size
+  data = memoryview(data)[:end]
+  offset = 0
+  while offset < end:
+    stream, size = unwrap(data, offset)
+    source = pa.BufferReader(stream)
+    table = pa.ipc.open_stream(source).read_all()
+    if size == 0:
+      size = (source.tell() + 7) // 8 * 8
+    yield table
+    offset += size
@@ -3,21 +3,29 @@ import pyarrow as pa
 import matplotlib.pyplot as plt
 import sys
 
+from aodStreams import read_tables
+
 tables = {}
 
-try:
-  while True:
-    reader = pa.ipc.open_stream(pa.PythonFile(sys.stdin))
-    t = reader.read_all()
-    print t.schema.metadata
-    tables[t.schema.metadata["description"]] = t
-except Exception,e:
-  pass
+# Reads the output of run2ESD2Run3AOD from stdin, or the file written with -o
+# given as argument. Compressed tables (--compression) are unwrapped by
+# read_tables, which raises on anything it cannot read.
+if len(sys.argv) > 1:
+  data = open(sys.argv[1], 'rb').read()
+else:
+  data = getattr(sys.stdin, 'buffer', sys.stdin).read()
+for t in read_tables(data):
+  print(t.schema.metadata)
+  # With --batch-events the same table comes in several streams
+  description = t.schema.metadata[b"description"]
+  if description in tables:
+    t = pa.concat_tables([tables[description], t])
+  tables[description] = t
 
 # A couple of plots to 
-df = tables["TRACKPAR"].to_pandas(zero_copy_only=True)
+df = tables[b"TRACKPAR"].to_pandas()
 h1 = df.hist(column='fSigned1Pt', bins=100, range=[-30,30])
 plt.savefig('figure.pdf')
-df2 = tables["CALO"].to_pandas(zero_copy_only=True)
+df2 = tables[b"CALO"].to_pandas()
 h2 = df2.hist(column='fAmplitude', bins=100, range=[0, 0.7])
 plt.savefig('figure2.pdf')